@@ -0,0 +1,681 @@
+#include <math_nerd/hill_cipher.h>
+#include <math_nerd/hill_key_loader.h>
+#include <math_nerd/hill_kronecker_key.h>
+#include <math_nerd/hill_lu_key.h>
+#include <math_nerd/hill_pipeline.h>
+#include <math_nerd/hill_prepared_key.h>
+#include <math_nerd/hill_rounds.h>
+#include <math_nerd/hill_socket.h>
+#include <math_nerd/hill_trace.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace hc = math_nerd::hill_cipher;
+
+namespace
+{
+    // Returns a random message of the given length drawn from the character table.
+    auto make_message(std::size_t length, std::uint64_t seed = 7) -> std::string
+    {
+        std::mt19937_64 rng{ seed };
+        std::uniform_int_distribution<std::size_t> symbol{ 0, hc::impl_details::ch_table.size() - 1 };
+
+        std::string msg(length, ' ');
+
+        for( auto &c : msg )
+        {
+            c = hc::impl_details::ch_table[symbol(rng)];
+        }
+
+        return msg;
+    }
+
+    // Runs fn repeatedly for at least min_seconds and returns the average seconds per call.
+    template<typename Fn>
+    auto time_per_call(Fn fn, double min_seconds = 0.25) -> double
+    {
+        using clock = std::chrono::steady_clock;
+
+        std::size_t calls = 0;
+        auto const start = clock::now();
+        std::chrono::duration<double> elapsed{ 0 };
+
+        do
+        {
+            fn();
+            ++calls;
+            elapsed = clock::now() - start;
+        } while( elapsed.count() < min_seconds );
+
+        return elapsed.count() / static_cast<double>(calls);
+    }
+
+    auto mib_per_second(std::size_t bytes, double seconds) -> double
+    {
+        return static_cast<double>(bytes) / seconds / (1024.0 * 1024.0);
+    }
+
+    // The int_mod<97> Gauss-Jordan inversion hill_key::inverse() used before z97_fast.
+    auto reference_inverse(hc::hill_key key) -> hc::hill_key
+    {
+        auto const size = key.row_count();
+        hc::hill_key inv{ size };
+
+        for( auto i = 0; i < size; ++i )
+        {
+            inv[i][i] = 1;
+        }
+
+        for( auto i = 0; i < size; ++i )
+        {
+            auto pivot = i;
+
+            while( pivot < size && key[pivot][i] == 0 )
+            {
+                ++pivot;
+            }
+
+            if( pivot == size )
+            {
+                throw std::invalid_argument("The matrix is not invertible.\n");
+            }
+
+            std::swap(key[i], key[pivot]);
+            std::swap(inv[i], inv[pivot]);
+
+            auto const d = key[i][i];
+
+            for( auto j = 0; j < size; ++j )
+            {
+                key[i][j] /= d;
+                inv[i][j] /= d;
+            }
+
+            for( auto row = 0; row < size; ++row )
+            {
+                if( row == i )
+                {
+                    continue;
+                }
+
+                auto const f = key[row][i];
+
+                for( auto j = 0; j < size; ++j )
+                {
+                    key[row][j] -= f * key[i][j];
+                    inv[row][j] -= f * inv[i][j];
+                }
+            }
+        }
+
+        return inv;
+    }
+
+    // The int_mod<97> encryption encrypt() used before the lazy kernel: a linear character search and a matrix_t multiply per block.
+    auto reference_encrypt(hc::hill_key const &key, std::string pt) -> std::string
+    {
+        auto const size = key.row_count();
+        auto const &table = hc::impl_details::ch_table;
+
+        while( pt.length() % size != 0 )
+        {
+            pt += ' ';
+        }
+
+        std::string ct(pt.size(), ' ');
+        hc::msg_block block(size);
+
+        for( std::size_t offset = 0; offset < pt.length(); offset += size )
+        {
+            for( auto j = 0; j < size; ++j )
+            {
+                block[j] = std::distance(table.begin(), std::find(table.begin(), table.end(), pt[offset + j]));
+            }
+
+            auto const cipher = key * block;
+
+            for( auto j = 0; j < size; ++j )
+            {
+                ct[offset + j] = hc::impl_details::z97_to_char(cipher[j][0]);
+            }
+        }
+
+        return ct;
+    }
+
+    auto bench_scalar() -> void
+    {
+        std::printf("== Fast kernels vs int_mod<97> ==\n");
+        std::printf("%6s %18s %18s %18s %18s\n", "size", "int_mod inv us", "z97_fast inv us", "int_mod MiB/s", "lazy MiB/s");
+
+        auto const pt = make_message(1 << 16);
+
+        for( std::int64_t size : { 8, 32, 128 } )
+        {
+            auto const key = hc::lu_key::generate(size, 42).to_key();
+
+            if( !(reference_inverse(key) == key.inverse()) || reference_encrypt(key, pt) != hc::encrypt(key, pt) )
+            {
+                throw std::logic_error("Fast kernels disagree with the int_mod<97> reference.\n");
+            }
+
+            auto const inverse_before = time_per_call([&] { reference_inverse(key); });
+            auto const inverse_after = time_per_call([&] { key.inverse(); });
+            auto const encrypt_before = time_per_call([&] { reference_encrypt(key, pt); });
+            auto const encrypt_after = time_per_call([&] { hc::encrypt(key, pt); });
+
+            std::printf("%6lld %18.2f %18.2f %18.2f %18.2f\n", static_cast<long long>(size), inverse_before * 1e6, inverse_after * 1e6,
+                        mib_per_second(pt.size(), encrypt_before), mib_per_second(pt.size(), encrypt_after));
+        }
+    }
+
+    auto bench_rounds() -> void
+    {
+        std::printf("== Multi-round cipher ==\n");
+        std::printf("%6s %7s %12s %18s\n", "size", "rounds", "MiB/s", "ns/block/round");
+
+        auto const pt = make_message(1 << 18);
+
+        for( std::int64_t size : { 8, 16, 32 } )
+        {
+            for( std::size_t rounds : { 1, 2, 4, 8 } )
+            {
+                auto const cipher = hc::round_cipher::generate(size, rounds, 42);
+
+                auto const seconds = time_per_call([&] { cipher.encrypt(pt); });
+                auto const blocks = static_cast<double>(pt.size()) / static_cast<double>(size);
+
+                std::printf("%6lld %7zu %12.2f %18.2f\n", static_cast<long long>(size), rounds, mib_per_second(pt.size(), seconds), seconds * 1e9 / blocks / static_cast<double>(rounds));
+            }
+        }
+    }
+
+    auto bench_pipeline() -> void
+    {
+        std::printf("== Fused pipeline: translate, multiply, pack ==\n");
+        std::printf("%6s %14s %15s\n", "size", "encrypt MiB/s", "pipeline MiB/s");
+
+        auto const pt = make_message(1 << 16);
+
+        for( std::int64_t size : { 8, 32 } )
+        {
+            auto const key = hc::lu_key::generate(size, 42).to_key();
+            auto const pipe = hc::pipeline_builder{}.translate().multiply(key).pack().build();
+
+            auto const plain = time_per_call([&] { hc::encrypt(key, pt); });
+            auto const fused = time_per_call([&] { pipe.run(pt); });
+
+            std::printf("%6lld %14.2f %15.2f\n", static_cast<long long>(size), mib_per_second(pt.size(), plain), mib_per_second(pt.size(), fused));
+        }
+    }
+
+    auto bench_lu() -> void
+    {
+        std::printf("== LU-factored keys: decrypt ==\n");
+        std::printf("%6s %16s %16s\n", "size", "dense us/call", "lu us/call");
+
+        auto const ct = make_message(4096);
+
+        for( std::int64_t size : { 16, 32, 64 } )
+        {
+            auto const factored = hc::lu_key::generate(size, 42);
+            auto const key = factored.to_key();
+
+            auto const dense = time_per_call([&] { hc::decrypt(key, ct); });
+            auto const lu = time_per_call([&] { factored.decrypt(ct); });
+
+            std::printf("%6lld %16.2f %16.2f\n", static_cast<long long>(size), dense * 1e6, lu * 1e6);
+        }
+    }
+
+    auto bench_kronecker() -> void
+    {
+        std::printf("== Kronecker keys: encrypt ==\n");
+        std::printf("%6s %12s %16s\n", "size", "dense MiB/s", "kronecker MiB/s");
+
+        auto const pt = make_message(1 << 16);
+
+        for( std::int64_t factor : { 8, 16, 32 } )
+        {
+            auto const key = hc::kronecker_key::generate(factor, factor, 1, 42);
+            auto const dense = key.to_key();
+
+            auto const dense_seconds = time_per_call([&] { hc::encrypt(dense, pt); });
+            auto const kronecker_seconds = time_per_call([&] { key.encrypt(pt); });
+
+            std::printf("%6lld %12.2f %16.2f\n", static_cast<long long>(key.size()), mib_per_second(pt.size(), dense_seconds), mib_per_second(pt.size(), kronecker_seconds));
+        }
+    }
+
+    auto bench_structure() -> void
+    {
+        std::printf("== Prepared keys: structure-specific kernels (size 64) ==\n");
+        std::printf("%18s %14s %16s\n", "structure", "encrypt MiB/s", "prepared MiB/s");
+
+        constexpr std::int64_t size = 64;
+        auto const pt = make_message(1 << 16);
+
+        auto const dense = hc::lu_key::generate(size, 42).to_key();
+        hc::hill_key upper{ size }, permutation{ size }, diagonal{ size };
+
+        for( auto i = 0; i < size; ++i )
+        {
+            for( auto j = i; j < size; ++j )
+            {
+                upper[i][j] = (i == j) ? 1 : dense[i][j];
+            }
+
+            permutation[i][(5 * i + 3) % size] = i % 96 + 1;
+            diagonal[i][i] = i % 96 + 1;
+        }
+
+        for( auto const &key : { dense, upper, permutation, diagonal } )
+        {
+            hc::prepared_key const prepared{ key };
+
+            auto const plain = time_per_call([&] { hc::encrypt(key, pt); });
+            auto const fast = time_per_call([&] { prepared.encrypt(pt); });
+
+            std::printf("%18s %14.2f %16.2f\n", hc::to_string(prepared.stats().encrypt.structure).c_str(), mib_per_second(pt.size(), plain), mib_per_second(pt.size(), fast));
+        }
+    }
+
+    auto bench_key_loading() -> void
+    {
+        std::printf("== Bulk key loading (2000 keys of size 16) ==\n");
+
+        constexpr std::int64_t size = 16;
+        std::mt19937_64 rng{ 5 };
+        std::uniform_int_distribution<int> symbol{ 0, 96 };
+
+        std::string file;
+        for( auto k = 0; k < 2000; ++k )
+        {
+            file += "key" + std::to_string(k) + " " + std::to_string(size);
+
+            for( auto e = 0; e < size * size; ++e )
+            {
+                file += " " + std::to_string(symbol(rng));
+            }
+
+            file += '\n';
+        }
+
+        // The old way: build each hill_key element by element, then is_valid_key and inverse() (which throws).
+        auto const naive = time_per_call([&]
+        {
+            std::istringstream in{ file };
+            std::string id;
+            std::int64_t n;
+
+            while( in >> id >> n )
+            {
+                hc::hill_key key{ n };
+
+                for( auto i = 0; i < n; ++i )
+                {
+                    for( auto j = 0; j < n; ++j )
+                    {
+                        std::int64_t value;
+                        in >> value;
+                        key[i][j] = value;
+                    }
+                }
+
+                try
+                {
+                    key.inverse();
+                }
+                catch( std::invalid_argument const & )
+                {
+                }
+            }
+        }, 1.0);
+
+        hc::thread_pool pool;
+        hc::load_report report;
+
+        auto const bulk = time_per_call([&] { report = hc::load_keys_from_string(file, pool); }, 1.0);
+
+        auto const ms = [](std::chrono::nanoseconds t) { return static_cast<double>(t.count()) / 1e6; };
+
+        std::printf("serial, throwing:  %9.2f ms\n", naive * 1e3);
+        std::printf("bulk (%zu threads): %9.2f ms (split %.2f, parse %.2f, validate %.2f, assemble %.2f)\n", pool.size(), bulk * 1e3,
+                    ms(report.timings.split), ms(report.timings.parse), ms(report.timings.validate), ms(report.timings.assemble));
+    }
+
+    // Returns both ends of a connected Unix domain socket pair, or of a TCP connection over loopback.
+    auto connected_pair(bool tcp) -> std::pair<int, int>
+    {
+        int fds[2] = { -1, -1 };
+
+        if( !tcp )
+        {
+            if( socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0 )
+            {
+                throw std::runtime_error("socketpair failed.\n");
+            }
+
+            return { fds[0], fds[1] };
+        }
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+
+        auto const listener = socket(AF_INET, SOCK_STREAM, 0);
+
+        if( listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&address), length) != 0 || listen(listener, 1) != 0
+            || getsockname(listener, reinterpret_cast<sockaddr *>(&address), &length) != 0 )
+        {
+            throw std::runtime_error("Could not listen on loopback.\n");
+        }
+
+        fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+
+        if( connect(fds[0], reinterpret_cast<sockaddr *>(&address), length) != 0 || (fds[1] = accept(listener, nullptr, nullptr)) < 0 )
+        {
+            throw std::runtime_error("Could not connect over loopback.\n");
+        }
+
+        close(listener);
+
+        int one = 1;
+        setsockopt(fds[0], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setsockopt(fds[1], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        return { fds[0], fds[1] };
+    }
+
+    auto write_all(int fd, char const *data, std::size_t length) -> void
+    {
+        while( length > 0 )
+        {
+            auto const sent = write(fd, data, length);
+
+            if( sent <= 0 )
+            {
+                throw std::runtime_error("write failed.\n");
+            }
+
+            data += sent;
+            length -= static_cast<std::size_t>(sent);
+        }
+    }
+
+    auto read_all(int fd, char *data, std::size_t length) -> void
+    {
+        while( length > 0 )
+        {
+            auto const got = read(fd, data, length);
+
+            if( got <= 0 )
+            {
+                throw std::runtime_error("read failed.\n");
+            }
+
+            data += got;
+            length -= static_cast<std::size_t>(got);
+        }
+    }
+
+    // Returns the q-quantile of the samples, in microseconds.
+    auto quantile_us(std::vector<double> samples, double q) -> double
+    {
+        std::sort(samples.begin(), samples.end());
+
+        return samples[static_cast<std::size_t>(q * static_cast<double>(samples.size() - 1))] * 1e6;
+    }
+
+    auto bench_sockets() -> void
+    {
+        using clock = std::chrono::steady_clock;
+
+        std::printf("== Encrypted sockets (key size 16) ==\n");
+        std::printf("%6s %10s %12s %14s %14s\n", "socket", "mode", "MiB/s", "p50 RTT us", "p99 RTT us");
+
+        auto const key = hc::lu_key::generate(16, 42).to_key();
+        auto const frame = make_message(16 * 1024);
+        auto const ping = make_message(64);
+        constexpr std::size_t frames = 2048;
+        constexpr std::size_t round_trips = 2000;
+
+        for( bool tcp : { false, true } )
+        {
+            // Plain: the same bytes with no framing or encryption.
+            double plain_seconds = 0.0;
+            std::vector<double> plain_rtt;
+            {
+                auto const [a, b] = connected_pair(tcp);
+                std::string buffer(frame.size(), ' ');
+
+                auto const start = clock::now();
+                std::thread sender{ [&, a = a]
+                {
+                    for( auto i = 0u; i < frames; ++i )
+                    {
+                        write_all(a, frame.data(), frame.size());
+                    }
+                } };
+
+                for( auto i = 0u; i < frames; ++i )
+                {
+                    read_all(b, buffer.data(), buffer.size());
+                }
+
+                sender.join();
+                plain_seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+                std::thread echo{ [&, b = b]
+                {
+                    std::string reply(ping.size(), ' ');
+
+                    for( auto i = 0u; i < round_trips; ++i )
+                    {
+                        read_all(b, reply.data(), reply.size());
+                        write_all(b, reply.data(), reply.size());
+                    }
+                } };
+
+                for( auto i = 0u; i < round_trips; ++i )
+                {
+                    auto const sent = clock::now();
+                    write_all(a, ping.data(), ping.size());
+                    read_all(a, buffer.data(), ping.size());
+                    plain_rtt.push_back(std::chrono::duration<double>(clock::now() - sent).count());
+                }
+
+                echo.join();
+                close(a);
+                close(b);
+            }
+
+            double encrypted_seconds = 0.0;
+            std::vector<double> encrypted_rtt;
+            {
+                auto const [a_fd, b_fd] = connected_pair(tcp);
+                hc::encrypted_socket a{ a_fd, key }, b{ b_fd, key };
+
+                auto const start = clock::now();
+                std::thread sender{ [&]
+                {
+                    for( auto i = 0u; i < frames; ++i )
+                    {
+                        a.send(frame);
+                    }
+
+                    a.flush();
+                } };
+
+                for( std::size_t received = 0; received < frames * frame.size(); )
+                {
+                    received += b.receive()->size();
+                }
+
+                sender.join();
+                encrypted_seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+                std::thread echo{ [&]
+                {
+                    for( auto i = 0u; i < round_trips; ++i )
+                    {
+                        b.send(*b.receive());
+                    }
+                } };
+
+                for( auto i = 0u; i < round_trips; ++i )
+                {
+                    auto const sent = clock::now();
+                    a.send(ping);
+                    a.receive();
+                    encrypted_rtt.push_back(std::chrono::duration<double>(clock::now() - sent).count());
+                }
+
+                echo.join();
+            }
+
+            auto const bytes = frames * frame.size();
+            char const *name = tcp ? "tcp" : "unix";
+
+            std::printf("%6s %10s %12.2f %14.2f %14.2f\n", name, "plain", mib_per_second(bytes, plain_seconds), quantile_us(plain_rtt, 0.5), quantile_us(plain_rtt, 0.99));
+            std::printf("%6s %10s %12.2f %14.2f %14.2f\n", name, "encrypted", mib_per_second(bytes, encrypted_seconds), quantile_us(encrypted_rtt, 0.5), quantile_us(encrypted_rtt, 0.99));
+        }
+    }
+
+    // A synthetic stand-in for a production trace: a few hot keys, mostly short payloads, mostly encryption.
+    auto synthetic_trace(std::size_t calls) -> std::vector<hc::trace_record>
+    {
+        std::mt19937_64 rng{ 11 };
+        std::exponential_distribution<double> gap_us{ 1.0 / 50.0 };
+        std::lognormal_distribution<double> length{ 5.0, 1.5 };
+        std::geometric_distribution<int> key_rank{ 0.3 };
+        std::bernoulli_distribution decrypt{ 0.1 };
+
+        std::int64_t const sizes[] = { 4, 16, 64 };
+
+        hc::trace_recorder recorder{ { 1, 2 } };
+        std::vector<hc::trace_record> trace;
+
+        for( auto i = 0u; i < calls; ++i )
+        {
+            auto const rank = std::min(key_rank(rng), 29);
+
+            hc::trace_record r;
+            r.gap = std::chrono::nanoseconds{ static_cast<std::int64_t>(gap_us(rng) * 1e3) };
+            r.key_id = recorder.anonymize("tenant" + std::to_string(rank % 3) + "/key" + std::to_string(rank));
+            r.key_size = sizes[rank % 3];
+            r.payload_length = std::min<std::uint64_t>(static_cast<std::uint64_t>(length(rng)), 1 << 16);
+            r.op = decrypt(rng) ? hc::filter_mode::decrypt : hc::filter_mode::encrypt;
+
+            trace.push_back(r);
+        }
+
+        return trace;
+    }
+
+    // Replays the trace file at path (or a synthetic trace) against each engine.
+    auto bench_replay(char const *path) -> void
+    {
+        std::vector<hc::trace_record> trace;
+
+        if( path != nullptr )
+        {
+            std::ifstream in{ path };
+
+            if( !in )
+            {
+                throw std::runtime_error(std::string{ "Could not open trace file " } + path + ".\n");
+            }
+
+            trace = hc::read_trace(in);
+        }
+        else
+        {
+            trace = synthetic_trace(3000);
+        }
+
+        std::printf("== Trace replay (%zu calls%s) ==\n", trace.size(), path != nullptr ? "" : ", synthetic");
+        std::printf("%22s %10s %10s %10s %10s %10s %10s\n", "engine", "speed", "ops/s", "MiB/s", "p50 us", "p99 us", "max us");
+
+        auto const plain = [](std::uint64_t, hc::hill_key const &key, hc::filter_mode op, std::string const &payload)
+        {
+            if( op == hc::filter_mode::encrypt )
+            {
+                hc::encrypt(key, payload);
+            }
+            else
+            {
+                hc::decrypt(key, payload);
+            }
+        };
+
+        std::map<std::uint64_t, std::unique_ptr<hc::prepared_key>> prepared;
+
+        auto const cached = [&](std::uint64_t key_id, hc::hill_key const &key, hc::filter_mode op, std::string const &payload)
+        {
+            auto &entry = prepared[key_id];
+
+            if( !entry )
+            {
+                entry = std::make_unique<hc::prepared_key>(key, hc::inversion::lazy);
+            }
+
+            if( op == hc::filter_mode::encrypt )
+            {
+                entry->encrypt(payload);
+            }
+            else
+            {
+                entry->decrypt(payload);
+            }
+        };
+
+        auto const us = [](std::chrono::nanoseconds t) { return static_cast<double>(t.count()) / 1e3; };
+
+        auto const print = [&](char const *engine, char const *speed, hc::replay_report const &report)
+        {
+            std::printf("%22s %10s %10.0f %10.2f %10.2f %10.2f %10.2f\n", engine, speed, report.operations_per_second(), report.mib_per_second(), us(report.p50), us(report.p99), us(report.max));
+        };
+
+        hc::replay_options recorded;
+        recorded.recorded_speed = true;
+
+        print("encrypt/decrypt", "max", hc::replay(trace, plain));
+        print("prepared_key cache", "max", hc::replay(trace, cached));
+        print("prepared_key cache", "recorded", hc::replay(trace, cached, recorded));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bench_pipeline();
+    bench_rounds();
+    bench_lu();
+    bench_kronecker();
+    bench_structure();
+    bench_key_loading();
+    bench_scalar();
+    bench_sockets();
+    bench_replay(argc > 1 ? argv[1] : nullptr);
+
+    return 0;
+}
@@ -3,11 +3,15 @@
 #define MATH_NERD_HILL_CIPHER_H
 #include <algorithm>
 #include <array>
+#include <cstdint>
+#include <optional>
 #include <sstream>
 #include <stdexcept>
+#include <string>
 #include <vector>
 #include <math_nerd/int_mod.h>
 #include <math_nerd/matrix_t.h>
+#include <math_nerd/hill_z97_fast.h>
 
 /** \file hill_cipher.h
     \brief A basic Hill Cipher implementation modulo 97.
@@ -34,174 +38,266 @@ namespace math_nerd
     }
 
     /** \fn auto hill_cipher::hill_key::inverse() const -> hill_cipher::hill_key
-        \brief Returns the inverse matrix of the hill ciper key.
+        \brief Returns the inverse matrix of the hill ciper key. Defined below, after try_inverse().
      */
     template<>
-    auto hill_cipher::hill_key::inverse() const -> hill_cipher::hill_key
-    {
-        auto size = row_count();
+    auto hill_cipher::hill_key::inverse() const -> hill_cipher::hill_key;
 
-        hill_cipher::hill_key dec_key{ size };
+    namespace hill_cipher
+    {
+        /** \enum filter_mode
+            \brief Whether a filter encrypts or decrypts its input.
+         */
+        enum class filter_mode
+        {
+            encrypt,
+            decrypt
+        };
 
-        if( size == 2 )
+        /** \namespace math_nerd::hill_cipher::impl_details
+            \brief Contains implementation details.
+         */
+        namespace impl_details
         {
-            // Check if determinant is 0.
-            if( mat[0][0] * mat[1][1] == mat[0][1] * mat[1][0] )
+            /** \property ch_table
+                \brief The character table.
+             */
+            constexpr std::array<char, 97> ch_table{
+            {
+                'A','B','C','D','E','F','G','H','I','J','K','L','M','N','O','P','Q','R','S','T','U','V','W','X','Y','Z',
+                'a','b','c','d','e','f','g','h','i','j','k','l','m','n','o','p','q','r','s','t','u','v','w','x','y','z',
+                '0','1','2','3','4','5','6','7','8','9',' ','~','-','=','!','@','#','$','%','^','&','*','(',')','_','+',
+                '[',']',';','\'',',','.','/','{','}',':','"','<','>','?','`', '\\', '|', '\t', '\n'
+            } };
+
+            /** \fn constexpr char z97_to_char(z97 num)
+                \brief Returns the character assigned to that integer modulo 97.
+             */
+            constexpr auto z97_to_char(z97 num) -> char
             {
-                throw std::invalid_argument("The matrix is not invertible.\n");
+                return ch_table[static_cast<std::size_t>(num.value())];
             }
 
-            // Calculate and hold determinant.
-            hill_cipher::z97 det = mat[0][0] * mat[1][1] - mat[0][1] * mat[1][0];
+            /** \fn constexpr auto make_symbol_table() -> std::array<std::uint8_t, 256>
+                \brief Maps every byte to its index in ch_table (characters outside the table map to 0).
+             */
+            constexpr auto make_symbol_table() -> std::array<std::uint8_t, 256>
+            {
+                std::array<std::uint8_t, 256> table{};
 
-            // This gives the inverse matrix for 2x2 matrices.
-            dec_key[0][0] = mat[1][1] / det;
-            dec_key[0][1] = -mat[0][1] / det;
-            dec_key[1][0] = -mat[1][0] / det;
-            dec_key[1][1] = mat[0][0] / det;
-        }
-        else
-        {
-            auto key{ *this };
-            // Creating identity matrix.
-            // dec_key acts as the augmented portion of the key matrix in the Gauss-Jordan Elimination algorithm.
-            for( auto i = 0; i < size; ++i )
+                for( auto i = 0u; i < ch_table.size(); ++i )
+                {
+                    table[static_cast<unsigned char>(ch_table[i])] = static_cast<std::uint8_t>(i);
+                }
+
+                return table;
+            }
+
+            /** \property symbol_table
+                \brief symbol_table[c] is the integer modulo 97 assigned to the character c.
+             */
+            constexpr std::array<std::uint8_t, 256> symbol_table = make_symbol_table();
+
+            /** \fn constexpr z97 char_to_z97(char c)
+                \brief Returns the integer modulo 97 assigned to that character.
+             */
+            constexpr auto char_to_z97(char const c) -> z97
             {
-                for( auto j = 0; j < size; ++j )
+                return symbol_table[static_cast<unsigned char>(c)];
+            }
+
+            /** \fn auto flatten(hill_key const &key) -> std::vector<std::uint32_t>
+                \brief Copies a key into a contiguous row-major array of its values.
+             */
+            auto flatten(hill_key const &key) -> std::vector<std::uint32_t>
+            {
+                std::int64_t size = key.row_count();
+                std::vector<std::uint32_t> flat(size * size);
+
+                for( auto i = 0; i < size; ++i )
                 {
-                    if( j == i )
-                    {
-                        dec_key[i][j] = 1;
-                    }
-                    else
+                    for( auto j = 0; j < size; ++j )
                     {
-                        dec_key[i][j] = 0;
+                        flat[i * size + j] = static_cast<std::uint32_t>(key[i][j].value());
                     }
                 }
+
+                return flat;
             }
 
-            for( auto i = 0; i < size; ++i )
+            /** \fn auto flatten_fast(hill_key const &key) -> std::vector<z97_fast>
+                \brief Copies a key into a contiguous row-major array of z97_fast, for elimination.
+             */
+            auto flatten_fast(hill_key const &key) -> std::vector<z97_fast>
             {
-                auto max_element = key[i][i].value();
-                auto max_row = i;
-                for( auto k = i + 1; k < size; ++k )
+                std::int64_t size = key.row_count();
+                std::vector<z97_fast> flat(size * size);
+
+                for( auto i = 0; i < size; ++i )
                 {
-                    if( key[k][i].value() > max_element )
+                    for( auto j = 0; j < size; ++j )
                     {
-                        max_element = key[k][i].value();
-                        max_row = k;
+                        flat[i * size + j] = key[i][j];
                     }
                 }
 
-                // Swap maximum element in pivot positions to their corresponding rows
-                if( i < max_row )
+                return flat;
+            }
+
+            /** \fn auto multiply_lazy(std::uint32_t const *key, std::uint32_t const *in, std::uint32_t *out, std::size_t size) -> void
+                \brief out = key * in, accumulating unreduced and reducing once per row. This is the multiply kernel behind
+                       encrypt(), prepared_key and the stream transforms.
+             */
+            auto multiply_lazy(std::uint32_t const *key, std::uint32_t const *in, std::uint32_t *out, std::size_t size) -> void
+            {
+                // Each product is < 97^2, so up to 2^32 / 97^2 > 456,000 of them fit before reducing.
+                for( auto i = 0u; i < size; ++i )
                 {
+                    std::uint32_t sum = 0;
+                    auto const row = key + i * size;
+
                     for( auto j = 0u; j < size; ++j )
                     {
-                        auto tmp = key[max_row][j];
-                        key[max_row][j] = key[i][j];
-                        key[i][j] = tmp;
-
-                        tmp = dec_key[max_row][j];
-                        dec_key[max_row][j] = dec_key[i][j];
-                        dec_key[i][j] = tmp;
+                        sum += row[j] * in[j];
                     }
+
+                    out[i] = sum % 97;
                 }
+            }
+
+            /** \fn auto eliminate(z97_fast *a, z97_fast *augmented, std::size_t size) -> bool
+                \brief Gauss-Jordan elimination of the row-major matrix a, applying the same row operations to augmented
+                       (if not null). Returns false instead of throwing if a is singular. If augmented is null, only the
+                       forward elimination needed to decide invertibility is done.
+
+                Runs on z97_fast: branchless adds, a fused subtract_product per entry and table inverses, instead of a
+                reduction per int_mod operation and a modular exponentiation per division.
+             */
+            auto eliminate(z97_fast *a, z97_fast *augmented, std::size_t size) -> bool
+            {
+                auto const swap_rows = [size](z97_fast *m, std::size_t r1, std::size_t r2)
+                {
+                    std::swap_ranges(m + r1 * size, m + (r1 + 1) * size, m + r2 * size);
+                };
 
-                // Make all elements in the rows below the pivot zero using row operations.
-                for( auto k = i + 1; k < size; ++k )
+                // row r -= f * row i.
+                auto const subtract = [size](z97_fast *m, std::size_t r, std::size_t i, z97_fast f, std::size_t from)
                 {
-                    if( key[i][i] == 0 )
+                    for( auto j = from; j < size; ++j )
                     {
-                        throw std::invalid_argument("The matrix is not invertible.\n");
+                        m[r * size + j].subtract_product(f, m[i * size + j]);
                     }
+                };
 
-                    auto d = key[k][i] / key[i][i];
+                for( auto i = 0u; i < size; ++i )
+                {
+                    auto pivot = i;
 
-                    for( auto j = 0; j < size; ++j )
+                    while( pivot < size && a[pivot * size + i] == 0 )
                     {
-                        key[k][j] -= d * key[i][j];
-                        dec_key[k][j] -= d * dec_key[i][j];
+                        ++pivot;
                     }
 
-                }
-            }
+                    if( pivot == size )
+                    {
+                        return false;
+                    }
 
-            // Turn key matrix into identity matrix using row operations.
-            // Copy these same row operations to dec_key to find the inverse matrix.
-            for( auto i = size - 1; i >= 0; --i )
-            {
-                if( key[i][i] == 0 )
-                {
-                    throw std::invalid_argument("The matrix is not invertible.\n");
-                }
+                    if( pivot != i )
+                    {
+                        swap_rows(a, i, pivot);
 
-                for( auto j = 0; j < size; ++j )
-                {
-                    dec_key[i][j] /= key[i][i];
-                }
+                        if( augmented != nullptr )
+                        {
+                            swap_rows(augmented, i, pivot);
+                        }
+                    }
 
-                key[i][i] = 1;
+                    auto const inv = a[i * size + i].inverse();
 
-                if( i != 0 )
-                {
-                    for( auto row = i - 1; row >= 0; --row )
-                    {   // Loop not infinite -- row = 0 breaks, but work needs to be done in that case first.
-                        for( auto column = 0; column < size; ++column )
+                    // Normalize the pivot row.
+                    for( auto j = i; j < size; ++j )
+                    {
+                        a[i * size + j] *= inv;
+                    }
+
+                    if( augmented != nullptr )
+                    {
+                        for( auto j = 0u; j < size; ++j )
+                        {
+                            augmented[i * size + j] *= inv;
+                        }
+                    }
+
+                    // Clear the column below (and, when inverting, above) the pivot.
+                    for( auto r = (augmented != nullptr ? 0u : i + 1); r < size; ++r )
+                    {
+                        auto const f = a[r * size + i];
+
+                        if( r == i || f == 0 )
                         {
-                            dec_key[row][column] -= dec_key[i][column] * key[row][i];
+                            continue;
                         }
 
-                        key[row][i] = 0;
+                        subtract(a, r, i, f, i);
 
-                        if( row == 0 )
+                        if( augmented != nullptr )
                         {
-                            break;
+                            subtract(augmented, r, i, f, 0);
                         }
                     }
                 }
-                else
-                {
-                    break;
-                }
-            }
-        }
 
-        return dec_key;
-    }
+                return true;
+            }
 
-    namespace hill_cipher
-    {
-        /** \namespace math_nerd::hill_cipher::impl_details
-            \brief Contains implementation details.
-         */
-        namespace impl_details
-        {
-            /** \property ch_table
-                \brief The character table.
+            /** \fn auto transform_in_place(std::uint32_t const *key, char *data, std::size_t length, std::size_t size) -> void
+                \brief Multiplies each size-symbol block of data (length a multiple of size) by the flattened key, in place.
              */
-            constexpr std::array<char, 97> ch_table{
+            auto transform_in_place(std::uint32_t const *key, char *data, std::size_t length, std::size_t size) -> void
             {
-                'A','B','C','D','E','F','G','H','I','J','K','L','M','N','O','P','Q','R','S','T','U','V','W','X','Y','Z',
-                'a','b','c','d','e','f','g','h','i','j','k','l','m','n','o','p','q','r','s','t','u','v','w','x','y','z',
-                '0','1','2','3','4','5','6','7','8','9',' ','~','-','=','!','@','#','$','%','^','&','*','(',')','_','+',
-                '[',']',';','\'',',','.','/','{','}',':','"','<','>','?','`', '\\', '|', '\t', '\n'
-            } };
+                std::vector<std::uint32_t> x(size), y(size);
 
-            /** \fn constexpr char z97_to_char(z97 num)
-                \brief Returns the character assigned to that integer modulo 97.
-             */
-            constexpr auto z97_to_char(z97 num) -> char
-            {
-                return ch_table[static_cast<std::size_t>(num.value())];
+                for( std::size_t offset = 0; offset < length; offset += size )
+                {
+                    for( auto j = 0u; j < size; ++j )
+                    {
+                        x[j] = static_cast<std::uint32_t>(char_to_z97(data[offset + j]).value());
+                    }
+
+                    multiply_lazy(key, x.data(), y.data(), size);
+
+                    for( auto j = 0u; j < size; ++j )
+                    {
+                        data[offset + j] = ch_table[y[j]];
+                    }
+                }
             }
 
-            /** \fn constexpr z97 char_to_z97(char c)
-                \brief Returns the integer modulo 97 assigned to that character.
+            /** \fn auto encrypt_blocks(std::uint32_t const *key, std::size_t size, std::string const &pt, std::string &ct, std::size_t first, std::size_t last) -> void
+                \brief Encrypts the message blocks [first, last) of padded plaintext pt into ct, which must already be sized,
+                       with the flattened key.
              */
-            constexpr auto char_to_z97(char const c) -> z97
+            auto encrypt_blocks(std::uint32_t const *key, std::size_t size, std::string const &pt, std::string &ct, std::size_t first, std::size_t last) -> void
             {
-                return std::distance(std::begin(ch_table), std::find(std::begin(ch_table), std::end(ch_table), c));
+                std::vector<std::uint32_t> x(size), y(size);
+
+                for( auto idx = first; idx < last; ++idx )
+                {
+                    auto const offset = idx * size;
+
+                    for( auto j = 0u; j < size; ++j )
+                    {
+                        x[j] = symbol_table[static_cast<unsigned char>(pt[offset + j])];
+                    }
+
+                    multiply_lazy(key, x.data(), y.data(), size);
+
+                    for( auto j = 0u; j < size; ++j )
+                    {
+                        ct[offset + j] = ch_table[y[j]];
+                    }
+                }
             }
 
         } // namespace impl_details
@@ -224,23 +320,8 @@ namespace math_nerd
             std::string ct;
             ct.resize(pt.size());
 
-            msg_block block(size);
-
             // Take each `size` characters as a message block and encrypt.
-            for( auto i = 0u, idx = 0u; i < pt.length(); i += static_cast<std::uint32_t>(size), ++idx )
-            {
-                for( auto j = 0; j < size; ++j )
-                {
-                    block[j] = char_to_z97(pt[i + j]);
-                }
-
-                auto cipher = key * block;
-
-                for( auto j = 0; j < size; ++j )
-                {
-                    ct[idx * size + j] = z97_to_char(cipher[j][0]);
-                }
-            }
+            encrypt_blocks(flatten(key).data(), static_cast<std::size_t>(size), pt, ct, 0, pt.length() / size);
 
             return ct;
         }
@@ -253,25 +334,66 @@ namespace math_nerd
             return encrypt(key.inverse(), ct);
         }
 
-        /** \fn auto is_valid_key(hill_key const &key) -> bool
-            \brief Determines if a provided key matrix is valid (invertible).
+        /** \fn auto try_inverse(hill_key const &key) -> std::optional<hill_key>
+            \brief Returns the inverse matrix of the key, or std::nullopt if it is not invertible (without throwing).
          */
-        auto is_valid_key(hill_key const &key) -> bool
+        auto try_inverse(hill_key const &key) -> std::optional<hill_key>
         {
-            try
+            std::int64_t size = key.row_count();
+
+            // inv acts as the augmented portion of the key matrix, starting as the identity.
+            auto a = impl_details::flatten_fast(key);
+            std::vector<z97_fast> inv(a.size());
+
+            for( auto i = 0; i < size; ++i )
+            {
+                inv[i * size + i] = 1;
+            }
+
+            if( !impl_details::eliminate(a.data(), inv.data(), static_cast<std::size_t>(size)) )
             {
-                key.inverse();
+                return std::nullopt;
             }
-            catch( std::invalid_argument const & )
+
+            hill_key dec_key{ size };
+
+            for( auto i = 0; i < size; ++i )
             {
-                return false;
+                for( auto j = 0; j < size; ++j )
+                {
+                    dec_key[i][j] = static_cast<z97>(inv[i * size + j]);
+                }
             }
 
-            return true;
+            return dec_key;
+        }
+
+        /** \fn auto is_valid_key(hill_key const &key) -> bool
+            \brief Determines if a provided key matrix is valid (invertible).
+         */
+        auto is_valid_key(hill_key const &key) -> bool
+        {
+            // Forward elimination decides invertibility; there is no need to form the inverse.
+            auto a = impl_details::flatten_fast(key);
+
+            return impl_details::eliminate(a.data(), nullptr, static_cast<std::size_t>(key.row_count()));
         }
 
     } // namespace hill_cipher
 
+    template<>
+    auto hill_cipher::hill_key::inverse() const -> hill_cipher::hill_key
+    {
+        auto dec_key = hill_cipher::try_inverse(*this);
+
+        if( !dec_key )
+        {
+            throw std::invalid_argument("The matrix is not invertible.\n");
+        }
+
+        return *std::move(dec_key);
+    }
+
 } // namespace math_nerd
 #endif // MATH_NERD_HILL_CIPHER
 
@@ -0,0 +1,552 @@
+#pragma once
+#ifndef MATH_NERD_HILL_CIPHER_PARALLEL_H
+#define MATH_NERD_HILL_CIPHER_PARALLEL_H
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(__linux__)
+#include <sched.h>
+#endif
+#include <math_nerd/hill_cipher.h>
+
+/** \file hill_cipher_parallel.h
+    \brief A cgroup-aware thread pool and parallel encryption/decryption on top of it.
+ */
+
+namespace math_nerd
+{
+    namespace hill_cipher
+    {
+        /** \struct cpu_limits
+            \brief The CPU limits that apply to this process.
+         */
+        struct cpu_limits
+        {
+            /** \property hardware_threads
+                \brief What std::thread::hardware_concurrency() reports (host cores inside a container).
+             */
+            std::int64_t hardware_threads{ 1 };
+
+            /** \property cpuset_cpus
+                \brief Number of CPUs in the cpuset / affinity mask, or 0 if unknown.
+             */
+            std::int64_t cpuset_cpus{ 0 };
+
+            /** \property quota_cpus
+                \brief CPU bandwidth quota in CPUs (quota / period from cpu.max), or 0 if unlimited.
+             */
+            double quota_cpus{ 0.0 };
+        };
+
+        /** \struct throttle_stats
+            \brief The CFS throttling counters from cpu.stat.
+         */
+        struct throttle_stats
+        {
+            std::uint64_t nr_periods{ 0 };
+            std::uint64_t nr_throttled{ 0 };
+            std::uint64_t throttled_usec{ 0 };
+        };
+
+        /** \struct pool_stats
+            \brief Statistics reported by a thread_pool.
+         */
+        struct pool_stats
+        {
+            /** \property threads
+                \brief The effective parallelism the pool was sized to.
+             */
+            std::size_t threads{ 0 };
+
+            /** \property limits
+                \brief The CPU limits that were detected when the pool was created.
+             */
+            cpu_limits limits;
+
+            /** \property tasks_run
+                \brief Number of tasks executed by the workers.
+             */
+            std::uint64_t tasks_run{ 0 };
+
+            /** \property throttling
+                \brief Throttling observed since the pool was created.
+             */
+            throttle_stats throttling;
+        };
+
+        namespace impl_details
+        {
+            /** \fn auto read_file(std::string const &path, std::string &contents) -> bool
+                \brief Reads a small (e.g. /proc or /sys) file, returning false if it cannot be opened.
+             */
+            auto read_file(std::string const &path, std::string &contents) -> bool
+            {
+                std::ifstream in{ path };
+
+                if( !in )
+                {
+                    return false;
+                }
+
+                std::ostringstream ss;
+                ss << in.rdbuf();
+                contents = ss.str();
+
+                return true;
+            }
+
+            /** \fn auto parse_cpu_max(std::string const &text) -> double
+                \brief Parses a cgroup v2 cpu.max ("$MAX $PERIOD") into a number of CPUs, 0 meaning unlimited.
+             */
+            auto parse_cpu_max(std::string const &text) -> double
+            {
+                std::istringstream in{ text };
+                std::string quota;
+                double period{ 100000.0 };
+
+                if( !(in >> quota) || quota == "max" )
+                {
+                    return 0.0;
+                }
+
+                in >> period;
+
+                try
+                {
+                    auto const q = std::stod(quota);
+                    return (q > 0.0 && period > 0.0) ? q / period : 0.0;
+                }
+                catch( std::exception const & )
+                {
+                    return 0.0;
+                }
+            }
+
+            /** \fn auto parse_cpu_list(std::string const &text) -> std::int64_t
+                \brief Counts the CPUs in a cpuset list such as "0-3,8,10-11".
+             */
+            auto parse_cpu_list(std::string const &text) -> std::int64_t
+            {
+                std::int64_t count{ 0 };
+                std::istringstream in{ text };
+                std::string range;
+
+                while( std::getline(in, range, ',') )
+                {
+                    range.erase(std::remove_if(range.begin(), range.end(), [](char c) { return std::isspace(static_cast<unsigned char>(c)); }), range.end());
+
+                    if( range.empty() )
+                    {
+                        continue;
+                    }
+
+                    try
+                    {
+                        auto const dash = range.find('-');
+
+                        if( dash == std::string::npos )
+                        {
+                            std::stoll(range);
+                            ++count;
+                        }
+                        else
+                        {
+                            auto const lo = std::stoll(range.substr(0, dash));
+                            auto const hi = std::stoll(range.substr(dash + 1));
+                            count += (hi >= lo) ? hi - lo + 1 : 0;
+                        }
+                    }
+                    catch( std::exception const & )
+                    {
+                        return 0;
+                    }
+                }
+
+                return count;
+            }
+
+            /** \fn auto parse_cpu_stat(std::string const &text) -> throttle_stats
+                \brief Extracts the throttling counters from a cgroup v2 cpu.stat.
+             */
+            auto parse_cpu_stat(std::string const &text) -> throttle_stats
+            {
+                throttle_stats stats;
+                std::istringstream in{ text };
+                std::string key;
+                std::uint64_t value;
+
+                while( in >> key >> value )
+                {
+                    if( key == "nr_periods" )
+                    {
+                        stats.nr_periods = value;
+                    }
+                    else if( key == "nr_throttled" )
+                    {
+                        stats.nr_throttled = value;
+                    }
+                    else if( key == "throttled_usec" )
+                    {
+                        stats.throttled_usec = value;
+                    }
+                }
+
+                return stats;
+            }
+
+            /** \fn auto own_cgroup_dir(std::string const &cgroup_root) -> std::string
+                \brief Returns the cgroup v2 directory of this process (from /proc/self/cgroup), or cgroup_root itself.
+             */
+            auto own_cgroup_dir(std::string const &cgroup_root) -> std::string
+            {
+                std::string contents;
+
+                if( read_file("/proc/self/cgroup", contents) )
+                {
+                    std::istringstream in{ contents };
+                    std::string line;
+
+                    while( std::getline(in, line) )
+                    {
+                        // The unified hierarchy is the "0::<path>" entry.
+                        if( line.rfind("0::", 0) == 0 )
+                        {
+                            auto path = line.substr(3);
+
+                            if( path.empty() || path == "/" )
+                            {
+                                return cgroup_root;
+                            }
+
+                            std::string probe;
+                            if( read_file(cgroup_root + path + "/cgroup.controllers", probe) )
+                            {
+                                return cgroup_root + path;
+                            }
+                        }
+                    }
+                }
+
+                return cgroup_root;
+            }
+
+        } // namespace impl_details
+
+        /** \fn auto detect_cpu_limits(std::string const &cgroup_root = "/sys/fs/cgroup") -> cpu_limits
+            \brief Reads the cgroup v2 cpu.max and cpuset limits (and the affinity mask) of this process.
+
+            Quotas are hierarchical, so the tightest cpu.max between this process' cgroup and cgroup_root wins.
+         */
+        auto detect_cpu_limits(std::string const &cgroup_root = "/sys/fs/cgroup") -> cpu_limits
+        {
+            using namespace impl_details;
+
+            cpu_limits limits;
+            limits.hardware_threads = std::max<std::int64_t>(1, std::thread::hardware_concurrency());
+
+            auto dir = own_cgroup_dir(cgroup_root);
+            std::string contents;
+
+            if( read_file(dir + "/cpuset.cpus.effective", contents) )
+            {
+                limits.cpuset_cpus = parse_cpu_list(contents);
+            }
+
+            for( ;; )
+            {
+                if( read_file(dir + "/cpu.max", contents) )
+                {
+                    auto const quota = parse_cpu_max(contents);
+
+                    if( quota > 0.0 && (limits.quota_cpus == 0.0 || quota < limits.quota_cpus) )
+                    {
+                        limits.quota_cpus = quota;
+                    }
+                }
+
+                if( dir.size() <= cgroup_root.size() )
+                {
+                    break;
+                }
+
+                dir.erase(dir.find_last_of('/'));
+            }
+
+#if defined(__linux__)
+            cpu_set_t mask;
+            CPU_ZERO(&mask);
+
+            if( sched_getaffinity(0, sizeof(mask), &mask) == 0 )
+            {
+                std::int64_t const affinity = CPU_COUNT(&mask);
+
+                if( affinity > 0 && (limits.cpuset_cpus == 0 || affinity < limits.cpuset_cpus) )
+                {
+                    limits.cpuset_cpus = affinity;
+                }
+            }
+#endif
+
+            return limits;
+        }
+
+        /** \fn auto effective_parallelism(cpu_limits const &limits) -> std::size_t
+            \brief The number of threads worth running: the smallest of the hardware, cpuset and (rounded up) quota limits.
+         */
+        auto effective_parallelism(cpu_limits const &limits) -> std::size_t
+        {
+            auto threads = limits.hardware_threads;
+
+            if( limits.cpuset_cpus > 0 )
+            {
+                threads = std::min(threads, limits.cpuset_cpus);
+            }
+
+            if( limits.quota_cpus > 0.0 )
+            {
+                threads = std::min(threads, static_cast<std::int64_t>(std::ceil(limits.quota_cpus)));
+            }
+
+            return static_cast<std::size_t>(std::max<std::int64_t>(1, threads));
+        }
+
+        /** \fn auto read_throttle_stats(std::string const &cgroup_root = "/sys/fs/cgroup") -> throttle_stats
+            \brief Reads the current cpu.stat throttling counters of this process' cgroup.
+         */
+        auto read_throttle_stats(std::string const &cgroup_root = "/sys/fs/cgroup") -> throttle_stats
+        {
+            std::string contents;
+
+            if( impl_details::read_file(impl_details::own_cgroup_dir(cgroup_root) + "/cpu.stat", contents) )
+            {
+                return impl_details::parse_cpu_stat(contents);
+            }
+
+            return {};
+        }
+
+        /** \class thread_pool
+            \brief A fixed-size pool of worker threads, sized to the CPU quota rather than the host's core count.
+         */
+        class thread_pool
+        {
+            public:
+                /** \fn thread_pool(std::size_t threads = 0)
+                    \brief Starts the workers. With threads == 0 the pool sizes itself from detect_cpu_limits().
+                 */
+                explicit thread_pool(std::size_t threads = 0)
+                    : limits{ detect_cpu_limits() }, baseline{ read_throttle_stats() }
+                {
+                    if( threads == 0 )
+                    {
+                        threads = effective_parallelism(limits);
+                    }
+
+                    workers.reserve(threads);
+
+                    for( auto i = 0u; i < threads; ++i )
+                    {
+                        workers.emplace_back([this] { work(); });
+                    }
+                }
+
+                thread_pool(thread_pool const &) = delete;
+                auto operator=(thread_pool const &) -> thread_pool & = delete;
+
+                ~thread_pool()
+                {
+                    {
+                        std::lock_guard<std::mutex> lock{ mutex };
+                        stopping = true;
+                    }
+
+                    ready.notify_all();
+
+                    for( auto &worker : workers )
+                    {
+                        worker.join();
+                    }
+                }
+
+                /** \fn auto size() const -> std::size_t
+                    \brief Returns the number of worker threads.
+                 */
+                auto size() const -> std::size_t
+                {
+                    return workers.size();
+                }
+
+                /** \fn auto parallel_for(std::size_t count, Fn fn) -> void
+                    \brief Calls fn(first, last) over contiguous chunks covering [0, count) and waits for all of them.
+
+                    The first exception thrown by any chunk is rethrown here.
+                 */
+                template<typename Fn>
+                auto parallel_for(std::size_t count, Fn fn) -> void
+                {
+                    if( count == 0 )
+                    {
+                        return;
+                    }
+
+                    auto const chunks = std::min(count, workers.size());
+
+                    std::mutex done_mutex;
+                    std::condition_variable done;
+                    std::size_t remaining{ chunks };
+                    std::exception_ptr error;
+
+                    for( auto c = 0u; c < chunks; ++c )
+                    {
+                        auto const first = count * c / chunks;
+                        auto const last = count * (c + 1) / chunks;
+
+                        submit([&, first, last]
+                        {
+                            std::exception_ptr caught;
+
+                            try
+                            {
+                                fn(first, last);
+                            }
+                            catch( ... )
+                            {
+                                caught = std::current_exception();
+                            }
+
+                            std::lock_guard<std::mutex> lock{ done_mutex };
+
+                            if( caught && !error )
+                            {
+                                error = caught;
+                            }
+
+                            if( --remaining == 0 )
+                            {
+                                done.notify_one();
+                            }
+                        });
+                    }
+
+                    std::unique_lock<std::mutex> lock{ done_mutex };
+                    done.wait(lock, [&] { return remaining == 0; });
+
+                    if( error )
+                    {
+                        std::rethrow_exception(error);
+                    }
+                }
+
+                /** \fn auto stats() const -> pool_stats
+                    \brief Returns the effective parallelism, detected limits, and throttling observed since construction.
+                 */
+                auto stats() const -> pool_stats
+                {
+                    pool_stats result;
+                    result.threads = workers.size();
+                    result.limits = limits;
+                    result.tasks_run = tasks_run.load(std::memory_order_relaxed);
+
+                    auto const now = read_throttle_stats();
+                    result.throttling.nr_periods = now.nr_periods - std::min(now.nr_periods, baseline.nr_periods);
+                    result.throttling.nr_throttled = now.nr_throttled - std::min(now.nr_throttled, baseline.nr_throttled);
+                    result.throttling.throttled_usec = now.throttled_usec - std::min(now.throttled_usec, baseline.throttled_usec);
+
+                    return result;
+                }
+
+            private:
+                auto submit(std::function<void()> task) -> void
+                {
+                    {
+                        std::lock_guard<std::mutex> lock{ mutex };
+                        tasks.push(std::move(task));
+                    }
+
+                    ready.notify_one();
+                }
+
+                auto work() -> void
+                {
+                    for( ;; )
+                    {
+                        std::function<void()> task;
+
+                        {
+                            std::unique_lock<std::mutex> lock{ mutex };
+                            ready.wait(lock, [this] { return stopping || !tasks.empty(); });
+
+                            if( tasks.empty() )
+                            {
+                                return;
+                            }
+
+                            task = std::move(tasks.front());
+                            tasks.pop();
+                        }
+
+                        task();
+                        tasks_run.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+
+                cpu_limits limits;
+                throttle_stats baseline;
+                std::vector<std::thread> workers;
+                std::queue<std::function<void()>> tasks;
+                std::mutex mutex;
+                std::condition_variable ready;
+                std::atomic<std::uint64_t> tasks_run{ 0 };
+                bool stopping{ false };
+        };
+
+        /** \fn auto parallel_encrypt(thread_pool &pool, hill_key const &key, std::string pt) -> std::string
+            \brief Encrypts like encrypt(), with the message blocks split across the pool's workers.
+         */
+        auto parallel_encrypt(thread_pool &pool, hill_key const &key, std::string pt) -> std::string
+        {
+            std::int64_t size = key.row_count();
+
+            // Pad plaintext to make its length a multiple of size
+            while( (pt.length() % size) != 0 )
+            {
+                pt += ' ';
+            }
+
+            std::string ct;
+            ct.resize(pt.size());
+
+            auto const flat = impl_details::flatten(key);
+
+            pool.parallel_for(pt.length() / size, [&](std::size_t first, std::size_t last)
+            {
+                impl_details::encrypt_blocks(flat.data(), static_cast<std::size_t>(size), pt, ct, first, last);
+            });
+
+            return ct;
+        }
+
+        /** \fn auto parallel_decrypt(thread_pool &pool, hill_key const &key, std::string const &ct) -> std::string
+            \brief Decrypts by calling parallel_encrypt with the inverse matrix.
+         */
+        auto parallel_decrypt(thread_pool &pool, hill_key const &key, std::string const &ct) -> std::string
+        {
+            return parallel_encrypt(pool, key.inverse(), ct);
+        }
+
+    } // namespace hill_cipher
+
+} // namespace math_nerd
+#endif // MATH_NERD_HILL_CIPHER_PARALLEL_H
@@ -0,0 +1,359 @@
+#pragma once
+#ifndef MATH_NERD_HILL_CSV_H
+#define MATH_NERD_HILL_CSV_H
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include <math_nerd/hill_cipher.h>
+
+/** \file hill_csv.h
+    \brief Streaming field-level encryption of selected CSV columns.
+ */
+
+namespace math_nerd
+{
+    namespace hill_cipher
+    {
+        /** \struct csv_options
+            \brief The CSV dialect and which columns to transform.
+         */
+        struct csv_options
+        {
+            /** \property columns
+                \brief Zero-based indices of the columns to encrypt (or decrypt).
+             */
+            std::vector<std::size_t> columns;
+
+            char delimiter{ ',' };
+            char quote{ '"' };
+
+            /** \property header
+                \brief If true, the first record is copied through unchanged.
+             */
+            bool header{ true };
+
+            filter_mode mode{ filter_mode::encrypt };
+
+            /** \property chunk_size
+                \brief Number of bytes read from the input at a time.
+             */
+            std::size_t chunk_size{ 1 << 20 };
+        };
+
+        /** \struct csv_stats
+            \brief What a csv_transform run did.
+         */
+        struct csv_stats
+        {
+            std::uint64_t records{ 0 };
+            std::uint64_t fields_transformed{ 0 };
+            std::uint64_t bytes_in{ 0 };
+            std::uint64_t bytes_out{ 0 };
+        };
+
+        namespace impl_details
+        {
+            /** \fn auto prefix_xor(std::uint64_t bits) -> std::uint64_t
+                \brief Bit i of the result is the XOR of bits 0..i, i.e. whether position i is inside quotes.
+             */
+            constexpr auto prefix_xor(std::uint64_t bits) -> std::uint64_t
+            {
+                bits ^= bits << 1;
+                bits ^= bits << 2;
+                bits ^= bits << 4;
+                bits ^= bits << 8;
+                bits ^= bits << 16;
+                bits ^= bits << 32;
+
+                return bits;
+            }
+
+            /** \fn auto lowest_set_bit(std::uint64_t bits) -> std::size_t
+                \brief The index of the lowest set bit of bits, which must not be 0.
+             */
+            auto lowest_set_bit(std::uint64_t bits) -> std::size_t
+            {
+#if defined(__GNUC__) || defined(__clang__)
+                return static_cast<std::size_t>(__builtin_ctzll(bits));
+#else
+                std::size_t index = 0;
+
+                while( (bits & 1) == 0 )
+                {
+                    bits >>= 1;
+                    ++index;
+                }
+
+                return index;
+#endif
+            }
+
+            /** \fn auto match_mask(char const *p, char c) -> std::uint64_t
+                \brief Bit i is set if p[i] == c, for the 64 bytes at p.
+             */
+            auto match_mask(char const *p, char c) -> std::uint64_t
+            {
+#if defined(__SSE2__)
+                auto const needle = _mm_set1_epi8(c);
+                std::uint64_t mask = 0;
+
+                for( auto i = 0; i < 4; ++i )
+                {
+                    auto const bytes = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + 16 * i));
+                    auto const bits = static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, needle)));
+                    mask |= static_cast<std::uint64_t>(bits) << (16 * i);
+                }
+
+                return mask;
+#else
+                std::uint64_t mask = 0;
+
+                for( auto i = 0; i < 64; ++i )
+                {
+                    mask |= static_cast<std::uint64_t>(p[i] == c) << i;
+                }
+
+                return mask;
+#endif
+            }
+
+            /** \fn auto find_separators(char const *data, std::size_t length, char delimiter, char quote, std::vector<std::uint32_t> &positions) -> void
+                \brief Appends the positions of delimiters and newlines outside of quotes, 64 bytes at a time.
+
+                data must start outside of quotes (at the start of a record).
+             */
+            auto find_separators(char const *data, std::size_t length, char delimiter, char quote, std::vector<std::uint32_t> &positions) -> void
+            {
+                std::uint64_t inside = 0;
+
+                for( std::size_t base = 0; base < length; base += 64 )
+                {
+                    char tail[64];
+                    auto p = data + base;
+
+                    if( length - base < 64 )
+                    {
+                        std::memset(tail, 0, sizeof(tail));
+                        std::memcpy(tail, p, length - base);
+                        p = tail;
+                    }
+
+                    // Quoted regions run from an opening quote up to its closing quote; "" toggles twice and cancels out.
+                    auto const quoted = prefix_xor(match_mask(p, quote)) ^ inside;
+                    inside = (quoted >> 63) ? ~std::uint64_t{ 0 } : 0;
+
+                    auto separators = (match_mask(p, delimiter) | match_mask(p, '\n')) & ~quoted;
+
+                    if( length - base < 64 )
+                    {
+                        separators &= (std::uint64_t{ 1 } << (length - base)) - 1;
+                    }
+
+                    while( separators != 0 )
+                    {
+                        positions.push_back(static_cast<std::uint32_t>(base + lowest_set_bit(separators)));
+                        separators &= separators - 1;
+                    }
+                }
+            }
+
+            /** \fn auto unquote(char const *field, std::size_t length, char quote, std::string &out) -> void
+                \brief Appends the value of a CSV field, removing surrounding quotes and undoubling inner ones.
+             */
+            auto unquote(char const *field, std::size_t length, char quote, std::string &out) -> void
+            {
+                if( length < 2 || field[0] != quote || field[length - 1] != quote )
+                {
+                    out.append(field, length);
+                    return;
+                }
+
+                for( std::size_t i = 1; i + 1 < length; ++i )
+                {
+                    out += field[i];
+
+                    if( field[i] == quote && field[i + 1] == quote )
+                    {
+                        ++i;
+                    }
+                }
+            }
+
+            /** \fn auto write_quoted(std::string &out, char const *value, std::size_t length, char quote) -> void
+                \brief Appends value as a quoted CSV field (ciphertext may contain delimiters, quotes and newlines).
+             */
+            auto write_quoted(std::string &out, char const *value, std::size_t length, char quote) -> void
+            {
+                out += quote;
+
+                for( std::size_t i = 0; i < length; ++i )
+                {
+                    if( value[i] == quote )
+                    {
+                        out += quote;
+                    }
+
+                    out += value[i];
+                }
+
+                out += quote;
+            }
+
+        } // namespace impl_details
+
+        /** \fn auto csv_transform(hill_key const &key, std::istream &in, std::ostream &out, csv_options const &options) -> csv_stats
+            \brief Copies CSV from in to out, replacing the fields of the selected columns with their encryption (or decryption).
+
+            Each field's value is padded and encrypted on its own, like encrypt(), and written as a quoted field; the other
+            fields, delimiters and line endings are copied byte for byte. Record boundaries are found 64 bytes at a time with
+            SIMD compares, and the selected fields of each chunk are transformed together in one multiply pass.
+            Throws std::invalid_argument if decrypting with a non-invertible key.
+         */
+        auto csv_transform(hill_key const &key, std::istream &in, std::ostream &out, csv_options const &options) -> csv_stats
+        {
+            using namespace impl_details;
+
+            csv_stats stats;
+
+            auto const size = static_cast<std::size_t>(key.row_count());
+            auto const flat = flatten(options.mode == filter_mode::encrypt ? key : key.inverse());
+
+            std::vector<bool> selected;
+            for( auto column : options.columns )
+            {
+                if( column >= selected.size() )
+                {
+                    selected.resize(column + 1, false);
+                }
+
+                selected[column] = true;
+            }
+
+            std::string buffer;
+            std::string output;
+            std::string batch;
+            std::vector<std::uint32_t> separators;
+
+            // A selected field of the current chunk: [begin, end) in buffer, and [batch_begin, batch_end) in batch.
+            struct field
+            {
+                std::size_t begin;
+                std::size_t end;
+                std::size_t batch_begin;
+                std::size_t batch_end;
+            };
+            std::vector<field> fields;
+
+            bool skip_header = options.header;
+            bool eof = false;
+
+            while( !eof )
+            {
+                auto const kept = buffer.size();
+                buffer.resize(kept + options.chunk_size);
+                in.read(buffer.data() + kept, static_cast<std::streamsize>(options.chunk_size));
+                auto const got = static_cast<std::size_t>(in.gcount());
+                buffer.resize(kept + got);
+                stats.bytes_in += got;
+                eof = (got == 0 || !in);
+
+                separators.clear();
+                find_separators(buffer.data(), buffer.size(), options.delimiter, options.quote, separators);
+
+                // Only complete records are processed; the rest waits for the next chunk (or EOF).
+                std::size_t complete = 0;
+                for( auto it = separators.rbegin(); it != separators.rend(); ++it )
+                {
+                    if( buffer[*it] == '\n' )
+                    {
+                        complete = *it + 1;
+                        break;
+                    }
+                }
+
+                if( eof && complete < buffer.size() )
+                {
+                    separators.push_back(static_cast<std::uint32_t>(buffer.size()));
+                    complete = buffer.size();
+                }
+
+                // Split into fields, gathering the selected values into one batch.
+                fields.clear();
+                batch.clear();
+
+                std::size_t begin = 0;
+                std::size_t column = 0;
+
+                for( auto position : separators )
+                {
+                    if( position >= complete && position != buffer.size() )
+                    {
+                        break;
+                    }
+
+                    // Keep a \r of a \r\n line ending out of the field.
+                    auto end = static_cast<std::size_t>(position);
+                    bool const end_of_record = (position == buffer.size() || buffer[position] == '\n');
+
+                    if( end_of_record && end > begin && buffer[end - 1] == '\r' )
+                    {
+                        --end;
+                    }
+
+                    if( !skip_header && column < selected.size() && selected[column] )
+                    {
+                        field f{ begin, end, batch.size(), 0 };
+                        unquote(buffer.data() + begin, end - begin, options.quote, batch);
+                        batch.append((size - (batch.size() - f.batch_begin) % size) % size, ' ');
+                        f.batch_end = batch.size();
+
+                        fields.push_back(f);
+                        ++stats.fields_transformed;
+                    }
+
+                    begin = position + 1;
+                    ++column;
+
+                    if( end_of_record )
+                    {
+                        column = 0;
+                        skip_header = false;
+                        ++stats.records;
+                    }
+                }
+
+                transform_in_place(flat.data(), batch.data(), batch.size(), size);
+
+                // Rebuild the output: original bytes between fields, transformed values for the selected ones.
+                output.clear();
+                std::size_t copied = 0;
+
+                for( auto const &f : fields )
+                {
+                    output.append(buffer, copied, f.begin - copied);
+                    write_quoted(output, batch.data() + f.batch_begin, f.batch_end - f.batch_begin, options.quote);
+                    copied = f.end;
+                }
+
+                output.append(buffer, copied, complete - copied);
+
+                out.write(output.data(), static_cast<std::streamsize>(output.size()));
+                stats.bytes_out += output.size();
+
+                buffer.erase(0, complete);
+            }
+
+            return stats;
+        }
+
+    } // namespace hill_cipher
+
+} // namespace math_nerd
+#endif // MATH_NERD_HILL_CSV_H
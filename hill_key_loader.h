@@ -0,0 +1,324 @@
+#pragma once
+#ifndef MATH_NERD_HILL_KEY_LOADER_H
+#define MATH_NERD_HILL_KEY_LOADER_H
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <math_nerd/hill_cipher.h>
+#include <math_nerd/hill_cipher_parallel.h>
+
+/** \file hill_key_loader.h
+    \brief Parallel bulk loading, validation and inversion of key files.
+
+    A key file holds one key per line: an id, the key size n, then the n * n entries in row-major order, separated by
+    whitespace. Blank lines and lines starting with '#' are ignored. For example, "alice 2 1 2 3 4".
+ */
+
+namespace math_nerd
+{
+    namespace hill_cipher
+    {
+        /** \struct loaded_key
+            \brief A key from a key file, with its inverse.
+         */
+        struct loaded_key
+        {
+            std::string id;
+            hill_key key{ 1 };
+            hill_key inverse{ 1 };
+        };
+
+        /** \struct rejected_key
+            \brief A line of a key file which did not yield a valid key.
+         */
+        struct rejected_key
+        {
+            std::size_t line{ 0 };
+            std::string id;
+            std::string reason;
+        };
+
+        /** \struct load_timings
+            \brief Wall-clock time spent in each phase of a load.
+         */
+        struct load_timings
+        {
+            std::chrono::nanoseconds read{ 0 };
+            std::chrono::nanoseconds split{ 0 };
+            std::chrono::nanoseconds parse{ 0 };
+            std::chrono::nanoseconds validate{ 0 };
+            std::chrono::nanoseconds assemble{ 0 };
+
+            auto total() const -> std::chrono::nanoseconds
+            {
+                return read + split + parse + validate + assemble;
+            }
+        };
+
+        /** \struct load_report
+            \brief The result of a bulk load: the valid keys (in file order), the rejected lines, and per-phase timings.
+         */
+        struct load_report
+        {
+            std::vector<loaded_key> keys;
+            std::vector<rejected_key> rejected;
+            load_timings timings;
+        };
+
+        namespace impl_details
+        {
+            /** \struct parsed_key
+                \brief A key file line parsed into flat arrays, before validation.
+             */
+            struct parsed_key
+            {
+                std::size_t line{ 0 };
+                std::string id;
+                std::size_t size{ 0 };
+                std::vector<z97_fast> entries;
+                std::vector<z97_fast> inverse;
+                std::string error;
+            };
+
+            /** \fn auto next_token(std::string_view &text) -> std::string_view
+                \brief Removes and returns the next whitespace-separated token of text.
+             */
+            auto next_token(std::string_view &text) -> std::string_view
+            {
+                auto const is_space = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+
+                std::size_t begin = 0;
+                while( begin < text.size() && is_space(text[begin]) )
+                {
+                    ++begin;
+                }
+
+                auto end = begin;
+                while( end < text.size() && !is_space(text[end]) )
+                {
+                    ++end;
+                }
+
+                auto const token = text.substr(begin, end - begin);
+                text.remove_prefix(end);
+
+                return token;
+            }
+
+            /** \fn auto parse_key_line(std::string_view text, std::size_t line) -> parsed_key
+                \brief Parses one key file line, recording (not throwing) any error.
+             */
+            auto parse_key_line(std::string_view text, std::size_t line) -> parsed_key
+            {
+                parsed_key result;
+                result.line = line;
+                result.id = std::string{ next_token(text) };
+
+                auto const parse_number = [](std::string_view token, std::uint64_t &value)
+                {
+                    auto const [end, error] = std::from_chars(token.data(), token.data() + token.size(), value);
+                    return error == std::errc{} && end == token.data() + token.size() && !token.empty();
+                };
+
+                std::uint64_t size = 0;
+                if( !parse_number(next_token(text), size) || size == 0 || size > 4096 )
+                {
+                    result.error = "invalid key size";
+                    return result;
+                }
+
+                result.size = static_cast<std::size_t>(size);
+                result.entries.resize(result.size * result.size);
+
+                for( auto &entry : result.entries )
+                {
+                    std::uint64_t value = 0;
+
+                    if( !parse_number(next_token(text), value) )
+                    {
+                        result.error = "missing or invalid entry";
+                        return result;
+                    }
+
+                    entry = z97_fast::from_reduced(static_cast<std::uint32_t>(value % 97));
+                }
+
+                if( !next_token(text).empty() )
+                {
+                    result.error = "too many entries";
+                }
+
+                return result;
+            }
+
+        } // namespace impl_details
+
+        /** \fn auto load_keys_from_string(std::string const &text, thread_pool &pool) -> load_report
+            \brief Parses, validates and inverts every key in the key file contents text, spreading the work over the pool.
+         */
+        auto load_keys_from_string(std::string const &text, thread_pool &pool) -> load_report
+        {
+            using namespace impl_details;
+            using clock = std::chrono::steady_clock;
+
+            load_report report;
+
+            auto const elapsed = [](clock::time_point since)
+            {
+                return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - since);
+            };
+
+            // Split into the lines which hold keys.
+            auto start = clock::now();
+
+            struct line_span
+            {
+                std::size_t number;
+                std::string_view text;
+            };
+            std::vector<line_span> lines;
+
+            std::string_view remaining{ text };
+            for( std::size_t number = 1; !remaining.empty(); ++number )
+            {
+                auto const end = remaining.find('\n');
+                auto line = remaining.substr(0, end);
+                remaining.remove_prefix(end == std::string_view::npos ? remaining.size() : end + 1);
+
+                auto const first = line.find_first_not_of(" \t\r");
+                if( first != std::string_view::npos && line[first] != '#' )
+                {
+                    lines.push_back({ number, line });
+                }
+            }
+
+            report.timings.split = elapsed(start);
+
+            // Parse.
+            start = clock::now();
+
+            std::vector<parsed_key> parsed(lines.size());
+            pool.parallel_for(lines.size(), [&](std::size_t first, std::size_t last)
+            {
+                for( auto i = first; i < last; ++i )
+                {
+                    parsed[i] = parse_key_line(lines[i].text, lines[i].number);
+                }
+            });
+
+            report.timings.parse = elapsed(start);
+
+            // Validate and invert in one elimination per key, without exceptions.
+            start = clock::now();
+
+            pool.parallel_for(parsed.size(), [&](std::size_t first, std::size_t last)
+            {
+                for( auto i = first; i < last; ++i )
+                {
+                    auto &key = parsed[i];
+
+                    if( !key.error.empty() )
+                    {
+                        continue;
+                    }
+
+                    auto a = key.entries;
+                    key.inverse.assign(a.size(), z97_fast{});
+
+                    for( auto j = 0u; j < key.size; ++j )
+                    {
+                        key.inverse[j * key.size + j] = 1;
+                    }
+
+                    if( !eliminate(a.data(), key.inverse.data(), key.size) )
+                    {
+                        key.error = "key is not invertible";
+                    }
+                }
+            });
+
+            report.timings.validate = elapsed(start);
+
+            // Build the hill_key objects.
+            start = clock::now();
+
+            std::vector<std::optional<loaded_key>> built(parsed.size());
+            pool.parallel_for(parsed.size(), [&](std::size_t first, std::size_t last)
+            {
+                auto const to_key = [](std::vector<z97_fast> const &flat, std::size_t size)
+                {
+                    hill_key key{ static_cast<std::int64_t>(size) };
+
+                    for( auto r = 0u; r < size; ++r )
+                    {
+                        for( auto c = 0u; c < size; ++c )
+                        {
+                            key[r][c] = static_cast<z97>(flat[r * size + c]);
+                        }
+                    }
+
+                    return key;
+                };
+
+                for( auto i = first; i < last; ++i )
+                {
+                    if( parsed[i].error.empty() )
+                    {
+                        built[i] = loaded_key{ parsed[i].id, to_key(parsed[i].entries, parsed[i].size), to_key(parsed[i].inverse, parsed[i].size) };
+                    }
+                }
+            });
+
+            for( auto i = 0u; i < parsed.size(); ++i )
+            {
+                if( built[i] )
+                {
+                    report.keys.push_back(std::move(*built[i]));
+                }
+                else
+                {
+                    report.rejected.push_back({ parsed[i].line, parsed[i].id, parsed[i].error });
+                }
+            }
+
+            report.timings.assemble = elapsed(start);
+
+            return report;
+        }
+
+        /** \fn auto load_keys(std::string const &path, thread_pool &pool) -> load_report
+            \brief Reads a key file and loads it with load_keys_from_string. Throws std::runtime_error if it cannot be read.
+         */
+        auto load_keys(std::string const &path, thread_pool &pool) -> load_report
+        {
+            auto const start = std::chrono::steady_clock::now();
+
+            std::ifstream in{ path, std::ios::binary };
+
+            if( !in )
+            {
+                throw std::runtime_error("Could not open key file " + path + ".\n");
+            }
+
+            std::ostringstream contents;
+            contents << in.rdbuf();
+
+            auto const read = std::chrono::steady_clock::now() - start;
+
+            auto report = load_keys_from_string(contents.str(), pool);
+            report.timings.read = std::chrono::duration_cast<std::chrono::nanoseconds>(read);
+
+            return report;
+        }
+
+    } // namespace hill_cipher
+
+} // namespace math_nerd
+#endif // MATH_NERD_HILL_KEY_LOADER_H
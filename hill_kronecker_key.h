@@ -0,0 +1,286 @@
+#pragma once
+#ifndef MATH_NERD_HILL_KRONECKER_KEY_H
+#define MATH_NERD_HILL_KRONECKER_KEY_H
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <math_nerd/hill_cipher.h>
+
+/** \file hill_kronecker_key.h
+    \brief Structured keys built from Kronecker products, K = (A_1 (x) B_1) * ... * (A_t (x) B_t).
+ */
+
+namespace math_nerd
+{
+    namespace hill_cipher
+    {
+        namespace impl_details
+        {
+            /** \fn auto kronecker_multiply(std::uint32_t const *a, std::uint32_t const *b, std::uint32_t const *x, std::uint32_t *y, std::uint32_t *tmp, std::size_t p, std::size_t q) -> void
+                \brief y = (A (x) B) * x for a p x p matrix A and a q x q matrix B, in p * q * (p + q) multiplies.
+
+                Viewing x as the row-major p x q matrix X, (A (x) B) * x is the row-major A * X * B^T.
+             */
+            auto kronecker_multiply(std::uint32_t const *a, std::uint32_t const *b, std::uint32_t const *x, std::uint32_t *y, std::uint32_t *tmp, std::size_t p, std::size_t q) -> void
+            {
+                // tmp = X * B^T; rows of X and rows of B are both contiguous.
+                for( auto k = 0u; k < p; ++k )
+                {
+                    multiply_lazy(b, x + k * q, tmp + k * q, q);
+                }
+
+                // y = A * tmp, accumulated a row of tmp at a time.
+                for( auto i = 0u; i < p; ++i )
+                {
+                    auto const out = y + i * q;
+                    std::fill(out, out + q, 0);
+
+                    for( auto k = 0u; k < p; ++k )
+                    {
+                        auto const coefficient = a[i * p + k];
+                        auto const row = tmp + k * q;
+
+                        for( auto j = 0u; j < q; ++j )
+                        {
+                            out[j] += coefficient * row[j];
+                        }
+                    }
+
+                    for( auto j = 0u; j < q; ++j )
+                    {
+                        out[j] %= 97;
+                    }
+                }
+            }
+
+        } // namespace impl_details
+
+        /** \class kronecker_key
+            \brief A Hill Cipher key given as a chain of Kronecker products, K = (A_1 (x) B_1) * ... * (A_t (x) B_t).
+
+            Each term may split the block size n = p * q differently. Multiplying a block costs n * (p + q) per term,
+            O(n^1.5) when p and q are near sqrt(n), and the inverse only needs the small factors inverted:
+            (A (x) B)^{-1} = A^{-1} (x) B^{-1}.
+         */
+        class kronecker_key
+        {
+            public:
+                /** \fn kronecker_key(hill_key const &a, hill_key const &b)
+                    \brief The key A (x) B. Throws std::invalid_argument if A or B is not invertible.
+                 */
+                kronecker_key(hill_key const &a, hill_key const &b)
+                    : kronecker_key{ std::vector<std::pair<hill_key, hill_key>>{ { a, b } } }
+                {
+                }
+
+                /** \fn kronecker_key(std::vector<std::pair<hill_key, hill_key>> const &factors)
+                    \brief The key (A_1 (x) B_1) * ... * (A_t (x) B_t). Throws std::invalid_argument if there are no factors,
+                           the terms have different sizes, or a factor is not invertible.
+                 */
+                explicit kronecker_key(std::vector<std::pair<hill_key, hill_key>> const &factors)
+                {
+                    if( factors.empty() )
+                    {
+                        throw std::invalid_argument("A Kronecker key needs at least one term.\n");
+                    }
+
+                    for( auto const &[a, b] : factors )
+                    {
+                        term t;
+                        t.p = static_cast<std::size_t>(a.row_count());
+                        t.q = static_cast<std::size_t>(b.row_count());
+                        t.a = impl_details::flatten(a);
+                        t.b = impl_details::flatten(b);
+                        t.a_inv = impl_details::flatten(a.inverse());
+                        t.b_inv = impl_details::flatten(b.inverse());
+
+                        if( !terms.empty() && t.p * t.q != n )
+                        {
+                            throw std::invalid_argument("All Kronecker terms must have the same size.\n");
+                        }
+
+                        n = t.p * t.q;
+                        terms.push_back(std::move(t));
+                    }
+                }
+
+                /** \fn static auto generate(std::int64_t p, std::int64_t q, std::size_t term_count, std::uint64_t seed) -> kronecker_key
+                    \brief Generates a chain of term_count random terms with p x p and q x q invertible factors.
+                 */
+                static auto generate(std::int64_t p, std::int64_t q, std::size_t term_count, std::uint64_t seed) -> kronecker_key
+                {
+                    std::mt19937_64 rng{ seed };
+                    std::uniform_int_distribution<std::int64_t> symbol{ 0, 96 };
+
+                    auto random_key = [&](std::int64_t size)
+                    {
+                        hill_key key{ size };
+
+                        do
+                        {
+                            for( auto i = 0; i < size; ++i )
+                            {
+                                for( auto j = 0; j < size; ++j )
+                                {
+                                    key[i][j] = symbol(rng);
+                                }
+                            }
+                        } while( !is_valid_key(key) );
+
+                        return key;
+                    };
+
+                    std::vector<std::pair<hill_key, hill_key>> factors;
+
+                    for( auto t = 0u; t < term_count; ++t )
+                    {
+                        auto a = random_key(p);
+                        auto b = random_key(q);
+                        factors.emplace_back(std::move(a), std::move(b));
+                    }
+
+                    return kronecker_key{ factors };
+                }
+
+                /** \fn auto size() const -> std::int64_t
+                    \brief Returns the block size of the key.
+                 */
+                auto size() const -> std::int64_t
+                {
+                    return static_cast<std::int64_t>(n);
+                }
+
+                /** \fn auto inverse() const -> kronecker_key
+                    \brief Returns the inverse key, the reversed chain of A_i^{-1} (x) B_i^{-1}.
+                 */
+                auto inverse() const -> kronecker_key
+                {
+                    kronecker_key result{ *this };
+
+                    std::reverse(result.terms.begin(), result.terms.end());
+
+                    for( auto &t : result.terms )
+                    {
+                        std::swap(t.a, t.a_inv);
+                        std::swap(t.b, t.b_inv);
+                    }
+
+                    return result;
+                }
+
+                /** \fn auto to_key() const -> hill_key
+                    \brief Returns the dense key (for verification).
+                 */
+                auto to_key() const -> hill_key
+                {
+                    hill_key key{ size() };
+
+                    std::vector<std::uint32_t> column(n), product(n), tmp(n);
+
+                    for( auto j = 0u; j < n; ++j )
+                    {
+                        std::fill(column.begin(), column.end(), 0);
+                        column[j] = 1;
+
+                        apply(column.data(), product.data(), tmp.data(), false);
+
+                        for( auto i = 0u; i < n; ++i )
+                        {
+                            key[i][j] = product[i];
+                        }
+                    }
+
+                    return key;
+                }
+
+                /** \fn auto encrypt(std::string pt) const -> std::string
+                    \brief Same result as hill_cipher::encrypt(to_key(), pt).
+                 */
+                auto encrypt(std::string pt) const -> std::string
+                {
+                    return transform(std::move(pt), false);
+                }
+
+                /** \fn auto decrypt(std::string ct) const -> std::string
+                    \brief Same result as hill_cipher::decrypt(to_key(), ct).
+                 */
+                auto decrypt(std::string ct) const -> std::string
+                {
+                    return transform(std::move(ct), true);
+                }
+
+            private:
+                struct term
+                {
+                    std::size_t p{ 0 };
+                    std::size_t q{ 0 };
+                    std::vector<std::uint32_t> a;
+                    std::vector<std::uint32_t> b;
+                    std::vector<std::uint32_t> a_inv;
+                    std::vector<std::uint32_t> b_inv;
+                };
+
+                // x = K * x (or K^{-1} * x); the rightmost term applies first.
+                auto apply(std::uint32_t *x, std::uint32_t *y, std::uint32_t *tmp, bool inverted) const -> void
+                {
+                    auto const step = [&](term const &t)
+                    {
+                        impl_details::kronecker_multiply(inverted ? t.a_inv.data() : t.a.data(), inverted ? t.b_inv.data() : t.b.data(), x, y, tmp, t.p, t.q);
+                        std::copy(y, y + n, x);
+                    };
+
+                    if( inverted )
+                    {
+                        std::for_each(terms.begin(), terms.end(), step);
+                    }
+                    else
+                    {
+                        std::for_each(terms.rbegin(), terms.rend(), step);
+                    }
+                }
+
+                auto transform(std::string in, bool inverted) const -> std::string
+                {
+                    using namespace impl_details;
+
+                    // Pad to make the length a multiple of size
+                    while( (in.length() % n) != 0 )
+                    {
+                        in += ' ';
+                    }
+
+                    std::string out;
+                    out.resize(in.size());
+
+                    std::vector<std::uint32_t> x(n), y(n), tmp(n);
+
+                    for( std::size_t offset = 0; offset < in.length(); offset += n )
+                    {
+                        for( auto j = 0u; j < n; ++j )
+                        {
+                            x[j] = static_cast<std::uint32_t>(char_to_z97(in[offset + j]).value());
+                        }
+
+                        apply(x.data(), y.data(), tmp.data(), inverted);
+
+                        for( auto j = 0u; j < n; ++j )
+                        {
+                            out[offset + j] = ch_table[x[j]];
+                        }
+                    }
+
+                    return out;
+                }
+
+                std::size_t n{ 0 };
+                std::vector<term> terms;
+        };
+
+    } // namespace hill_cipher
+
+} // namespace math_nerd
+#endif // MATH_NERD_HILL_KRONECKER_KEY_H
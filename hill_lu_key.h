@@ -0,0 +1,348 @@
+#pragma once
+#ifndef MATH_NERD_HILL_LU_KEY_H
+#define MATH_NERD_HILL_LU_KEY_H
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include <math_nerd/hill_cipher.h>
+
+/** \file hill_lu_key.h
+    \brief Keys stored in factored form K = P * L * U, so decryption needs two triangular solves and no inverse.
+ */
+
+namespace math_nerd
+{
+    namespace hill_cipher
+    {
+        namespace impl_details
+        {
+            /** \fn auto dot_lazy(std::uint32_t const *a, std::uint32_t const *b, std::size_t count) -> std::uint32_t
+                \brief The unreduced sum of a[j] * b[j] for residues below 97, four products per instruction with SSE2.
+             */
+            auto dot_lazy(std::uint32_t const *a, std::uint32_t const *b, std::size_t count) -> std::uint32_t
+            {
+                std::uint32_t sum = 0;
+                std::size_t j = 0;
+
+#if defined(__SSE2__)
+                // A residue below 97 fills only the low 16 bits of its 32-bit lane, so pmaddwd's sum of the two
+                // 16-bit products in each lane is exactly a[j] * b[j].
+                auto acc = _mm_setzero_si128();
+
+                for( ; j + 4 <= count; j += 4 )
+                {
+                    auto const x = _mm_loadu_si128(reinterpret_cast<__m128i const *>(a + j));
+                    auto const y = _mm_loadu_si128(reinterpret_cast<__m128i const *>(b + j));
+                    acc = _mm_add_epi32(acc, _mm_madd_epi16(x, y));
+                }
+
+                acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+                acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+                sum = static_cast<std::uint32_t>(_mm_cvtsi128_si32(acc));
+#endif
+
+                for( ; j < count; ++j )
+                {
+                    sum += a[j] * b[j];
+                }
+
+                return sum;
+            }
+
+            /** \fn auto upper_multiply(std::uint32_t const *upper, std::uint32_t const *in, std::uint32_t *out, std::size_t size) -> void
+                \brief out = U * in for upper triangular U, reducing once per row.
+             */
+            auto upper_multiply(std::uint32_t const *upper, std::uint32_t const *in, std::uint32_t *out, std::size_t size) -> void
+            {
+                for( auto i = 0u; i < size; ++i )
+                {
+                    out[i] = dot_lazy(upper + i * size + i, in + i, size - i) % 97;
+                }
+            }
+
+            /** \fn auto unit_lower_multiply(std::uint32_t const *lower, std::uint32_t const *in, std::uint32_t *out, std::size_t size) -> void
+                \brief out = L * in for unit lower triangular L, reducing once per row.
+             */
+            auto unit_lower_multiply(std::uint32_t const *lower, std::uint32_t const *in, std::uint32_t *out, std::size_t size) -> void
+            {
+                for( auto i = 0u; i < size; ++i )
+                {
+                    out[i] = (in[i] + dot_lazy(lower + i * size, in, i)) % 97;
+                }
+            }
+
+            /** \fn auto unit_lower_solve(std::uint32_t const *lower, std::uint32_t *x, std::size_t size) -> void
+                \brief Solves L * z = x in place for unit lower triangular L.
+             */
+            auto unit_lower_solve(std::uint32_t const *lower, std::uint32_t *x, std::size_t size) -> void
+            {
+                for( auto i = 1u; i < size; ++i )
+                {
+                    x[i] = reduce_once(x[i] + 97 - dot_lazy(lower + i * size, x, i) % 97);
+                }
+            }
+
+            /** \fn auto upper_solve(std::uint32_t const *upper, std::uint32_t const *inv_diagonal, std::uint32_t *x, std::size_t size) -> void
+                \brief Solves U * z = x in place for upper triangular U, given the inverses of its diagonal.
+             */
+            auto upper_solve(std::uint32_t const *upper, std::uint32_t const *inv_diagonal, std::uint32_t *x, std::size_t size) -> void
+            {
+                for( auto i = size; i-- > 0; )
+                {
+                    auto const sum = dot_lazy(upper + i * size + i + 1, x + i + 1, size - i - 1);
+
+                    x[i] = barrett_reduce(reduce_once(x[i] + 97 - sum % 97) * inv_diagonal[i]);
+                }
+            }
+
+        } // namespace impl_details
+
+        /** \class lu_key
+            \brief A Hill Cipher key K = P * L * U, with P a permutation, L unit lower triangular and U upper triangular.
+
+            Encryption is two triangular multiplies and decryption is two triangular solves; the inverse of K is never formed.
+            Every row of those kernels is one dot_lazy call, vectorized with SSE2 and reduced once.
+         */
+        class lu_key
+        {
+            public:
+                /** \fn lu_key(hill_key const &key)
+                    \brief Factors a key by Gaussian elimination. Throws std::invalid_argument if the key is not invertible.
+                 */
+                explicit lu_key(hill_key const &key)
+                    : n{ static_cast<std::size_t>(key.row_count()) }, perm(n), lower(n * n, 0), upper(impl_details::flatten(key)), inv_diagonal(n)
+                {
+                    std::iota(perm.begin(), perm.end(), std::size_t{ 0 });
+
+                    // Eliminate in place in `upper`, storing the multipliers in `lower` and the row swaps in `perm`.
+                    for( auto i = 0u; i < n; ++i )
+                    {
+                        auto pivot = i;
+
+                        while( pivot < n && upper[pivot * n + i] == 0 )
+                        {
+                            ++pivot;
+                        }
+
+                        if( pivot == n )
+                        {
+                            throw std::invalid_argument("The matrix is not invertible.\n");
+                        }
+
+                        if( pivot != i )
+                        {
+                            std::swap(perm[i], perm[pivot]);
+
+                            for( auto j = 0u; j < n; ++j )
+                            {
+                                std::swap(upper[i * n + j], upper[pivot * n + j]);
+                                std::swap(lower[i * n + j], lower[pivot * n + j]);
+                            }
+                        }
+
+                        auto const inv = static_cast<std::uint32_t>((z97{ 1 } / z97{ upper[i * n + i] }).value());
+
+                        for( auto k = i + 1; k < n; ++k )
+                        {
+                            auto const d = upper[k * n + i] * inv % 97;
+                            lower[k * n + i] = d;
+
+                            for( auto j = i; j < n; ++j )
+                            {
+                                upper[k * n + j] = (upper[k * n + j] + 97 * 97 - d * upper[i * n + j]) % 97;
+                            }
+                        }
+                    }
+
+                    for( auto i = 0u; i < n; ++i )
+                    {
+                        lower[i * n + i] = 1;
+                    }
+
+                    finish();
+                }
+
+                /** \fn static auto generate(std::int64_t size, std::uint64_t seed) -> lu_key
+                    \brief Generates a random key directly in factored form; no elimination or inversion is needed.
+                 */
+                static auto generate(std::int64_t size, std::uint64_t seed) -> lu_key
+                {
+                    std::mt19937_64 rng{ seed };
+                    std::uniform_int_distribution<std::uint32_t> symbol{ 0, 96 };
+                    std::uniform_int_distribution<std::uint32_t> nonzero{ 1, 96 };
+
+                    lu_key result;
+                    auto const n = static_cast<std::size_t>(size);
+
+                    result.n = n;
+                    result.perm.resize(n);
+                    result.lower.assign(n * n, 0);
+                    result.upper.assign(n * n, 0);
+                    result.inv_diagonal.resize(n);
+
+                    std::iota(result.perm.begin(), result.perm.end(), std::size_t{ 0 });
+                    std::shuffle(result.perm.begin(), result.perm.end(), rng);
+
+                    for( auto i = 0u; i < n; ++i )
+                    {
+                        for( auto j = 0u; j < i; ++j )
+                        {
+                            result.lower[i * n + j] = symbol(rng);
+                        }
+
+                        result.lower[i * n + i] = 1;
+                        result.upper[i * n + i] = nonzero(rng);
+
+                        for( auto j = i + 1; j < n; ++j )
+                        {
+                            result.upper[i * n + j] = symbol(rng);
+                        }
+                    }
+
+                    result.finish();
+
+                    return result;
+                }
+
+                /** \fn auto size() const -> std::int64_t
+                    \brief Returns the block size of the key.
+                 */
+                auto size() const -> std::int64_t
+                {
+                    return static_cast<std::int64_t>(n);
+                }
+
+                /** \fn auto to_key() const -> hill_key
+                    \brief Multiplies the factors back together into a dense key (for verification).
+                 */
+                auto to_key() const -> hill_key
+                {
+                    hill_key key{ size() };
+
+                    std::vector<std::uint32_t> column(n), product(n), tmp(n);
+
+                    for( auto j = 0u; j < n; ++j )
+                    {
+                        std::fill(column.begin(), column.end(), 0);
+                        column[j] = 1;
+
+                        apply_forward(column.data(), product.data(), tmp.data());
+
+                        for( auto i = 0u; i < n; ++i )
+                        {
+                            key[i][j] = product[i];
+                        }
+                    }
+
+                    return key;
+                }
+
+                /** \fn auto encrypt(std::string pt) const -> std::string
+                    \brief Same result as hill_cipher::encrypt(to_key(), pt).
+                 */
+                auto encrypt(std::string pt) const -> std::string
+                {
+                    return transform(std::move(pt), [this](std::uint32_t *x, std::uint32_t *y, std::uint32_t *tmp)
+                    {
+                        apply_forward(x, y, tmp);
+                    });
+                }
+
+                /** \fn auto decrypt(std::string ct) const -> std::string
+                    \brief Same result as hill_cipher::decrypt(to_key(), ct), computed by triangular solves.
+                 */
+                auto decrypt(std::string ct) const -> std::string
+                {
+                    return transform(std::move(ct), [this](std::uint32_t *x, std::uint32_t *y, std::uint32_t *)
+                    {
+                        // L * U * y = P^{-1} * x
+                        for( auto i = 0u; i < n; ++i )
+                        {
+                            y[i] = x[perm[i]];
+                        }
+
+                        impl_details::unit_lower_solve(lower.data(), y, n);
+                        impl_details::upper_solve(upper.data(), inv_diagonal.data(), y, n);
+                    });
+                }
+
+            private:
+                lu_key() = default;
+
+                auto finish() -> void
+                {
+                    for( auto i = 0u; i < n; ++i )
+                    {
+                        inv_diagonal[i] = static_cast<std::uint32_t>((z97{ 1 } / z97{ upper[i * n + i] }).value());
+                    }
+                }
+
+                // y = P * L * U * x
+                auto apply_forward(std::uint32_t const *x, std::uint32_t *y, std::uint32_t *tmp) const -> void
+                {
+                    impl_details::upper_multiply(upper.data(), x, y, n);
+                    impl_details::unit_lower_multiply(lower.data(), y, tmp, n);
+
+                    for( auto i = 0u; i < n; ++i )
+                    {
+                        y[perm[i]] = tmp[i];
+                    }
+                }
+
+                template<typename Kernel>
+                auto transform(std::string in, Kernel kernel) const -> std::string
+                {
+                    using namespace impl_details;
+
+                    // Pad to make the length a multiple of size
+                    while( (in.length() % n) != 0 )
+                    {
+                        in += ' ';
+                    }
+
+                    std::string out;
+                    out.resize(in.size());
+
+                    std::vector<std::uint32_t> x(n), y(n), tmp(n);
+
+                    for( std::size_t offset = 0; offset < in.length(); offset += n )
+                    {
+                        for( auto j = 0u; j < n; ++j )
+                        {
+                            x[j] = static_cast<std::uint32_t>(char_to_z97(in[offset + j]).value());
+                        }
+
+                        kernel(x.data(), y.data(), tmp.data());
+
+                        for( auto j = 0u; j < n; ++j )
+                        {
+                            out[offset + j] = ch_table[y[j]];
+                        }
+                    }
+
+                    return out;
+                }
+
+                std::size_t n{ 0 };
+
+                /** \property perm
+                    \brief Row i of L * U is row perm[i] of K.
+                 */
+                std::vector<std::size_t> perm;
+                std::vector<std::uint32_t> lower;
+                std::vector<std::uint32_t> upper;
+                std::vector<std::uint32_t> inv_diagonal;
+        };
+
+    } // namespace hill_cipher
+
+} // namespace math_nerd
+#endif // MATH_NERD_HILL_LU_KEY_H
@@ -0,0 +1,227 @@
+#pragma once
+#ifndef MATH_NERD_HILL_PIPE_FILTER_H
+#define MATH_NERD_HILL_PIPE_FILTER_H
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <optional>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <math_nerd/hill_cipher.h>
+
+/** \file hill_pipe_filter.h
+    \brief A stdin-to-stdout style filter which hands encrypted pages to the output pipe with vmsplice instead of copying them.
+ */
+
+namespace math_nerd
+{
+    namespace hill_cipher
+    {
+        /** \struct filter_stats
+            \brief What a pipe_filter run did.
+         */
+        struct filter_stats
+        {
+            std::uint64_t bytes_in{ 0 };
+            std::uint64_t bytes_out{ 0 };
+            std::uint64_t read_calls{ 0 };
+            std::uint64_t vmsplice_calls{ 0 };
+            std::uint64_t write_calls{ 0 };
+
+            /** \property buffers
+                \brief Number of page-aligned buffers mapped: one per chunk when vmsplicing, since spliced pages are
+                       never reused, and one in total otherwise.
+             */
+            std::uint64_t buffers{ 0 };
+        };
+
+        namespace impl_details
+        {
+            /** \fn auto throw_errno(char const *what) -> void
+                \brief Throws std::system_error for the current errno.
+             */
+            [[noreturn]] auto throw_errno(char const *what) -> void
+            {
+                throw std::system_error{ errno, std::generic_category(), what };
+            }
+
+            /** \struct page_buffer
+                \brief An anonymous page-aligned mapping, unmapped on destruction. Pages already handed to a pipe with
+                       vmsplice stay referenced by the pipe after the unmap.
+             */
+            struct page_buffer
+            {
+                explicit page_buffer(std::size_t bytes)
+                    : length{ bytes }
+                {
+                    auto const p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+                    if( p == MAP_FAILED )
+                    {
+                        throw_errno("pipe_filter: mmap");
+                    }
+
+                    data = static_cast<char *>(p);
+                }
+
+                page_buffer(page_buffer const &) = delete;
+                auto operator=(page_buffer const &) -> page_buffer & = delete;
+
+                ~page_buffer()
+                {
+                    munmap(data, length);
+                }
+
+                char *data{ nullptr };
+                std::size_t length{ 0 };
+            };
+
+        } // namespace impl_details
+
+        /** \fn auto pipe_filter(hill_key const &key, int in_fd, int out_fd, filter_mode mode = filter_mode::encrypt) -> filter_stats
+            \brief Reads in_fd to EOF, encrypts (or decrypts) it like encrypt()/decrypt(), and writes the result to out_fd.
+
+            Input is read into page-aligned buffers of one pipe capacity each and transformed in place. When out_fd is a pipe,
+            the buffers are handed to it with vmsplice, so the kernel references the pages instead of copying them. A reader
+            may splice those references onward, so there is no telling when the pages are free again: every chunk gets a
+            freshly mapped buffer, which is unmapped (not reused) once spliced. Otherwise the output is written with write()
+            from a single reused buffer. Throws std::system_error on I/O errors and std::invalid_argument
+            if decrypting with a non-invertible key.
+         */
+        auto pipe_filter(hill_key const &key, int in_fd, int out_fd, filter_mode mode = filter_mode::encrypt) -> filter_stats
+        {
+            using namespace impl_details;
+
+            filter_stats stats;
+
+            auto const size = static_cast<std::size_t>(key.row_count());
+            auto const flat = flatten(mode == filter_mode::encrypt ? key : key.inverse());
+            auto const page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+
+            bool use_vmsplice = false;
+            std::size_t capacity = 16 * page;
+
+#if defined(__linux__)
+            if( auto const pipe_size = fcntl(out_fd, F_GETPIPE_SZ); pipe_size > 0 )
+            {
+                use_vmsplice = true;
+                capacity = static_cast<std::size_t>(pipe_size);
+            }
+#endif
+
+            // Each chunk is a whole number of blocks, so it can be transformed as soon as it is read.
+            auto const chunk = std::max(size, capacity / size * size);
+            auto const buffer_bytes = (chunk + page - 1) / page * page;
+
+            // Only the write() path may reuse its buffer.
+            std::optional<page_buffer> reusable;
+
+            auto const emit = [&](char *data, std::size_t length)
+            {
+                while( length > 0 )
+                {
+                    ssize_t written = -1;
+
+#if defined(__linux__)
+                    if( use_vmsplice )
+                    {
+                        iovec iov{ data, length };
+                        written = vmsplice(out_fd, &iov, 1, 0);
+                        ++stats.vmsplice_calls;
+
+                        if( written < 0 && (errno == EINVAL || errno == EBADF) )
+                        {
+                            // Not a pipe after all (or vmsplice unsupported); fall back to copying.
+                            use_vmsplice = false;
+                            continue;
+                        }
+                    }
+                    else
+#endif
+                    {
+                        written = write(out_fd, data, length);
+                        ++stats.write_calls;
+                    }
+
+                    if( written < 0 )
+                    {
+                        if( errno == EINTR )
+                        {
+                            continue;
+                        }
+
+                        throw_errno("pipe_filter: output");
+                    }
+
+                    data += written;
+                    length -= static_cast<std::size_t>(written);
+                    stats.bytes_out += static_cast<std::uint64_t>(written);
+                }
+            };
+
+            for( bool eof = false; !eof; )
+            {
+                std::optional<page_buffer> fresh;
+                auto &buffer = use_vmsplice ? fresh : reusable;
+
+                if( !buffer )
+                {
+                    buffer.emplace(buffer_bytes);
+                    ++stats.buffers;
+                }
+
+                auto const data = buffer->data;
+                std::size_t filled = 0;
+
+                while( filled < chunk )
+                {
+                    auto const got = read(in_fd, data + filled, chunk - filled);
+                    ++stats.read_calls;
+
+                    if( got < 0 )
+                    {
+                        if( errno == EINTR )
+                        {
+                            continue;
+                        }
+
+                        throw_errno("pipe_filter: input");
+                    }
+
+                    if( got == 0 )
+                    {
+                        eof = true;
+                        break;
+                    }
+
+                    filled += static_cast<std::size_t>(got);
+                }
+
+                stats.bytes_in += filled;
+
+                // Pad the final block with spaces, as encrypt() does.
+                while( filled % size != 0 )
+                {
+                    data[filled++] = ' ';
+                }
+
+                if( filled == 0 )
+                {
+                    break;
+                }
+
+                transform_in_place(flat.data(), data, filled, size);
+
+                emit(data, filled);
+            }
+
+            return stats;
+        }
+
+    } // namespace hill_cipher
+
+} // namespace math_nerd
+#endif // MATH_NERD_HILL_PIPE_FILTER_H
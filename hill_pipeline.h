@@ -0,0 +1,255 @@
+#pragma once
+#ifndef MATH_NERD_HILL_PIPELINE_H
+#define MATH_NERD_HILL_PIPELINE_H
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <math_nerd/hill_cipher.h>
+
+/** \file hill_pipeline.h
+    \brief A runtime-composed transform pipeline which runs all of its stages over one cache-sized tile at a time.
+ */
+
+namespace math_nerd
+{
+    namespace hill_cipher
+    {
+        /** \struct pipeline_result
+            \brief The output of a pipeline run, plus the checksum if a checksum stage was added.
+         */
+        struct pipeline_result
+        {
+            std::string output;
+            std::uint64_t checksum{ 0 };
+        };
+
+        /** \class pipeline
+            \brief A sequence of stages over message symbols, built by pipeline_builder.
+
+            Each tile of the input is translated once, passed through every stage while it is still in cache,
+            and packed once, so adding stages adds compute but not passes over memory.
+         */
+        class pipeline
+        {
+            public:
+                /** \property default_tile_symbols
+                    \brief Default number of symbols per tile (16 KiB of reduced 32-bit residues).
+                 */
+                static constexpr std::size_t default_tile_symbols = 4096;
+
+                /** \fn auto block_size() const -> std::int64_t
+                    \brief Returns the block size the input is padded to (the key size, or 1 without a multiply stage).
+                 */
+                auto block_size() const -> std::int64_t
+                {
+                    return block;
+                }
+
+                /** \fn auto run(std::string const &in) const -> pipeline_result
+                    \brief Runs the pipeline over in, padding it with spaces to a multiple of block_size().
+                 */
+                auto run(std::string const &in) const -> pipeline_result
+                {
+                    using namespace impl_details;
+
+                    pipeline_result result;
+                    result.checksum = checksum_basis;
+
+                    auto const size = static_cast<std::size_t>(block);
+                    auto const padded = (in.length() + size - 1) / size * size;
+                    auto const tile = std::max(size, tile_symbols / size * size);
+
+                    result.output.resize(padded);
+
+                    std::vector<std::uint32_t> buffer(tile);
+                    std::vector<std::uint32_t> scratch(size);
+                    context ctx{ scratch, result.checksum };
+
+                    for( std::size_t first = 0; first < padded; first += tile )
+                    {
+                        auto const count = std::min(tile, padded - first);
+
+                        // Load (and translate) the tile, padding past the end of the input.
+                        for( auto i = 0u; i < count; ++i )
+                        {
+                            auto const pos = first + i;
+                            auto const c = (pos < in.length()) ? in[pos] : ' ';
+
+                            buffer[i] = translate_input ? symbol_table[static_cast<unsigned char>(c)] : static_cast<unsigned char>(c) % 97u;
+                        }
+
+                        for( auto const &stage : stages )
+                        {
+                            stage(buffer.data(), count, first, ctx);
+                        }
+
+                        // Store (and pack) the tile.
+                        for( auto i = 0u; i < count; ++i )
+                        {
+                            result.output[first + i] = pack_output ? ch_table[buffer[i]] : static_cast<char>(buffer[i]);
+                        }
+                    }
+
+                    return result;
+                }
+
+            private:
+                friend class pipeline_builder;
+
+                struct context
+                {
+                    std::vector<std::uint32_t> &scratch;
+                    std::uint64_t &checksum;
+                };
+
+                // Stages work on residues already reduced into [0, 97).
+                using stage_fn = std::function<void(std::uint32_t *, std::size_t, std::size_t, context &)>;
+
+                static constexpr std::uint64_t checksum_basis = 14695981039346656037ULL;
+
+                std::vector<stage_fn> stages;
+                std::int64_t block{ 1 };
+                std::size_t tile_symbols{ default_tile_symbols };
+                bool translate_input{ false };
+                bool pack_output{ false };
+        };
+
+        /** \class pipeline_builder
+            \brief Composes a pipeline at runtime, e.g.
+                   pipeline_builder{}.translate().multiply(key).offset(tweak).checksum().pack().build().
+         */
+        class pipeline_builder
+        {
+            public:
+                /** \fn auto translate() -> pipeline_builder &
+                    \brief Input bytes are characters of the table; otherwise they are raw symbol values.
+                 */
+                auto translate() -> pipeline_builder &
+                {
+                    result.translate_input = true;
+                    return *this;
+                }
+
+                /** \fn auto multiply(hill_key const &key) -> pipeline_builder &
+                    \brief Multiplies each block by key. All multiply stages must have the same size.
+                 */
+                auto multiply(hill_key const &key) -> pipeline_builder &
+                {
+                    std::int64_t size = key.row_count();
+
+                    if( has_multiply && size != result.block )
+                    {
+                        throw std::invalid_argument("All multiply stages must use keys of the same size.\n");
+                    }
+
+                    has_multiply = true;
+                    result.block = size;
+
+                    result.stages.emplace_back([flat = impl_details::flatten(key), n = static_cast<std::size_t>(size)](std::uint32_t *data, std::size_t count, std::size_t, pipeline::context &ctx)
+                    {
+                        auto &block = ctx.scratch;
+
+                        for( std::size_t offset = 0; offset < count; offset += n )
+                        {
+                            impl_details::multiply_lazy(flat.data(), data + offset, block.data(), n);
+                            std::copy(block.begin(), block.begin() + n, data + offset);
+                        }
+                    });
+
+                    return *this;
+                }
+
+                /** \fn auto offset(msg_block offsets) -> pipeline_builder &
+                    \brief Adds offsets[p % offsets.size()] to the symbol at position p of the message.
+                 */
+                auto offset(msg_block offsets) -> pipeline_builder &
+                {
+                    if( offsets.empty() )
+                    {
+                        throw std::invalid_argument("The offset stage needs at least one offset.\n");
+                    }
+
+                    std::vector<std::uint32_t> reduced(offsets.size());
+                    for( auto i = 0u; i < offsets.size(); ++i )
+                    {
+                        reduced[i] = static_cast<std::uint32_t>(offsets[i].value());
+                    }
+
+                    result.stages.emplace_back([offsets = std::move(reduced)](std::uint32_t *data, std::size_t count, std::size_t first, pipeline::context &)
+                    {
+                        auto idx = first % offsets.size();
+
+                        for( auto i = 0u; i < count; ++i )
+                        {
+                            data[i] = impl_details::reduce_once(data[i] + offsets[idx]);
+
+                            if( ++idx == offsets.size() )
+                            {
+                                idx = 0;
+                            }
+                        }
+                    });
+
+                    return *this;
+                }
+
+                /** \fn auto checksum() -> pipeline_builder &
+                    \brief Folds the symbols, as they are at this point of the pipeline, into an FNV-1a checksum.
+                 */
+                auto checksum() -> pipeline_builder &
+                {
+                    result.stages.emplace_back([](std::uint32_t *data, std::size_t count, std::size_t, pipeline::context &ctx)
+                    {
+                        auto hash = ctx.checksum;
+
+                        for( auto i = 0u; i < count; ++i )
+                        {
+                            hash ^= static_cast<std::uint64_t>(data[i]);
+                            hash *= 1099511628211ULL;
+                        }
+
+                        ctx.checksum = hash;
+                    });
+
+                    return *this;
+                }
+
+                /** \fn auto pack() -> pipeline_builder &
+                    \brief Output bytes are characters of the table; otherwise they are raw symbol values.
+                 */
+                auto pack() -> pipeline_builder &
+                {
+                    result.pack_output = true;
+                    return *this;
+                }
+
+                /** \fn auto tile_size(std::size_t symbols) -> pipeline_builder &
+                    \brief Sets the number of symbols per tile (rounded down to a whole number of blocks).
+                 */
+                auto tile_size(std::size_t symbols) -> pipeline_builder &
+                {
+                    result.tile_symbols = symbols;
+                    return *this;
+                }
+
+                /** \fn auto build() const -> pipeline
+                    \brief Returns the composed pipeline.
+                 */
+                auto build() const -> pipeline
+                {
+                    return result;
+                }
+
+            private:
+                pipeline result;
+                bool has_multiply{ false };
+        };
+
+    } // namespace hill_cipher
+
+} // namespace math_nerd
+#endif // MATH_NERD_HILL_PIPELINE_H
@@ -0,0 +1,1041 @@
+#pragma once
+#ifndef MATH_NERD_HILL_PREPARED_KEY_H
+#define MATH_NERD_HILL_PREPARED_KEY_H
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include <math_nerd/hill_cipher.h>
+
+/** \file hill_prepared_key.h
+    \brief Keys with precomputed data for repeated encryption and decryption.
+ */
+
+namespace math_nerd
+{
+    namespace hill_cipher
+    {
+        /** \enum key_structure
+            \brief The structure detected in a key, which selects the multiply kernel and the way it is inverted.
+         */
+        enum class key_structure
+        {
+            dense,
+            sparse,
+            diagonal,
+            permutation,
+            upper_triangular,
+            lower_triangular,
+            block_diagonal
+        };
+
+        /** \fn auto to_string(key_structure structure) -> std::string
+            \brief Returns the name of a key structure.
+         */
+        auto to_string(key_structure structure) -> std::string
+        {
+            switch( structure )
+            {
+                case key_structure::sparse:           return "sparse";
+                case key_structure::diagonal:         return "diagonal";
+                case key_structure::permutation:      return "permutation";
+                case key_structure::upper_triangular: return "upper triangular";
+                case key_structure::lower_triangular: return "lower triangular";
+                case key_structure::block_diagonal:   return "block diagonal";
+                default:                              return "dense";
+            }
+        }
+
+        /** \struct key_analysis
+            \brief The structure of a key, as found at preparation time.
+         */
+        struct key_analysis
+        {
+            key_structure structure{ key_structure::dense };
+
+            /** \property nonzeros
+                \brief Number of nonzero entries.
+             */
+            std::size_t nonzeros{ 0 };
+
+            /** \property blocks
+                \brief Sizes of the diagonal blocks (a single block unless the key is block diagonal).
+             */
+            std::vector<std::int64_t> blocks;
+        };
+
+        /** \enum inversion
+            \brief When a prepared_key computes its inverse.
+         */
+        enum class inversion
+        {
+            eager,      ///< In the constructor, which throws if the key is not invertible.
+            lazy,       ///< On the first decrypt() or inverse().
+            background  ///< Queued by the constructor on a shared idle-priority thread (or on first use, if sooner).
+        };
+
+        /** \struct prepared_key_stats
+            \brief What was detected and chosen when a prepared_key was prepared, and when its inverse became ready.
+         */
+        struct prepared_key_stats
+        {
+            key_analysis encrypt;
+
+            /** \property decrypt
+                \brief The structure of the inverse; only meaningful once inverse_ready is true.
+             */
+            key_analysis decrypt;
+
+            bool inverse_ready{ false };
+
+            /** \property time_to_inverse
+                \brief Time from preparation until the inverse was ready.
+             */
+            std::chrono::nanoseconds time_to_inverse{ 0 };
+
+            /** \property inverse_compute_time
+                \brief Time spent computing the inverse itself.
+             */
+            std::chrono::nanoseconds inverse_compute_time{ 0 };
+
+            /** \property inverse_waits
+                \brief Number of decrypt()/inverse() calls which found the inverse not ready and had to compute or wait for it.
+             */
+            std::uint64_t inverse_waits{ 0 };
+        };
+
+        namespace impl_details
+        {
+            /** \fn auto analyze(hill_key const &key) -> key_analysis
+                \brief Detects diagonal, permutation, triangular and block diagonal structure, and zero sparsity.
+             */
+            auto analyze(hill_key const &key) -> key_analysis
+            {
+                std::int64_t size = key.row_count();
+
+                key_analysis result;
+
+                bool upper = true, lower = true;
+                std::vector<std::int64_t> row_count(size, 0), column_count(size, 0);
+
+                // extent[i] is the furthest index that row i or column i reaches; blocks end where no earlier index reaches past.
+                std::vector<std::int64_t> extent(size);
+                std::iota(extent.begin(), extent.end(), std::int64_t{ 0 });
+
+                for( auto i = 0; i < size; ++i )
+                {
+                    for( auto j = 0; j < size; ++j )
+                    {
+                        if( key[i][j] == 0 )
+                        {
+                            continue;
+                        }
+
+                        ++result.nonzeros;
+                        ++row_count[i];
+                        ++column_count[j];
+
+                        upper = upper && (j >= i);
+                        lower = lower && (j <= i);
+
+                        extent[i] = std::max<std::int64_t>(extent[i], j);
+                        extent[j] = std::max<std::int64_t>(extent[j], i);
+                    }
+                }
+
+                std::int64_t reach = 0, block_start = 0;
+
+                for( auto i = 0; i < size; ++i )
+                {
+                    reach = std::max(reach, extent[i]);
+
+                    if( reach == i )
+                    {
+                        result.blocks.push_back(i + 1 - block_start);
+                        block_start = i + 1;
+                    }
+                }
+
+                auto const one_per_line = [size](std::vector<std::int64_t> const &counts)
+                {
+                    return std::all_of(counts.begin(), counts.end(), [](std::int64_t c) { return c == 1; }) && size > 0;
+                };
+
+                if( upper && lower )
+                {
+                    result.structure = key_structure::diagonal;
+                }
+                else if( one_per_line(row_count) && one_per_line(column_count) )
+                {
+                    result.structure = key_structure::permutation;
+                }
+                else if( upper )
+                {
+                    result.structure = key_structure::upper_triangular;
+                }
+                else if( lower )
+                {
+                    result.structure = key_structure::lower_triangular;
+                }
+                else if( result.blocks.size() > 1 )
+                {
+                    result.structure = key_structure::block_diagonal;
+                }
+                else if( result.nonzeros * 4 <= static_cast<std::size_t>(size * size) )
+                {
+                    result.structure = key_structure::sparse;
+                }
+
+                if( result.structure != key_structure::block_diagonal )
+                {
+                    result.blocks.assign(1, size);
+                }
+
+                return result;
+            }
+
+            /** \fn auto upper_triangular_inverse(hill_key const &key) -> hill_key
+                \brief Inverts an upper triangular key by back substitution, one column at a time.
+             */
+            auto upper_triangular_inverse(hill_key const &key) -> hill_key
+            {
+                std::int64_t size = key.row_count();
+
+                hill_key inv{ size };
+
+                for( auto i = 0; i < size; ++i )
+                {
+                    if( key[i][i] == 0 )
+                    {
+                        throw std::invalid_argument("The matrix is not invertible.\n");
+                    }
+                }
+
+                for( auto j = 0; j < size; ++j )
+                {
+                    inv[j][j] = z97{ 1 } / key[j][j];
+
+                    for( auto i = j - 1; i >= 0; --i )
+                    {
+                        z97 sum{ 0 };
+
+                        for( auto k = i + 1; k <= j; ++k )
+                        {
+                            sum += key[i][k] * inv[k][j];
+                        }
+
+                        inv[i][j] = -sum / key[i][i];
+                    }
+                }
+
+                return inv;
+            }
+
+            /** \fn auto transpose(hill_key const &key) -> hill_key
+                \brief Returns the transpose of a key.
+             */
+            auto transpose(hill_key const &key) -> hill_key
+            {
+                std::int64_t size = key.row_count();
+
+                hill_key result{ size };
+
+                for( auto i = 0; i < size; ++i )
+                {
+                    for( auto j = 0; j < size; ++j )
+                    {
+                        result[j][i] = key[i][j];
+                    }
+                }
+
+                return result;
+            }
+
+            /** \fn auto structured_inverse(hill_key const &key, key_analysis const &analysis) -> hill_key
+                \brief Inverts a key using its structure: closed forms for diagonal and permutation keys, substitution for
+                       triangular keys, and block by block for block diagonal keys. Throws std::invalid_argument if singular.
+             */
+            auto structured_inverse(hill_key const &key, key_analysis const &analysis) -> hill_key
+            {
+                std::int64_t size = key.row_count();
+
+                switch( analysis.structure )
+                {
+                    case key_structure::diagonal:
+                    case key_structure::permutation:
+                    {
+                        // K[i][j] = d != 0 becomes K^{-1}[j][i] = 1 / d.
+                        hill_key inv{ size };
+
+                        for( auto i = 0; i < size; ++i )
+                        {
+                            for( auto j = 0; j < size; ++j )
+                            {
+                                if( key[i][j] != 0 )
+                                {
+                                    inv[j][i] = z97{ 1 } / key[i][j];
+                                }
+                            }
+                        }
+
+                        if( analysis.structure == key_structure::diagonal && analysis.nonzeros != static_cast<std::size_t>(size) )
+                        {
+                            throw std::invalid_argument("The matrix is not invertible.\n");
+                        }
+
+                        return inv;
+                    }
+
+                    case key_structure::upper_triangular:
+                        return upper_triangular_inverse(key);
+
+                    case key_structure::lower_triangular:
+                        return transpose(upper_triangular_inverse(transpose(key)));
+
+                    case key_structure::block_diagonal:
+                    {
+                        hill_key inv{ size };
+                        std::int64_t start = 0;
+
+                        for( auto block : analysis.blocks )
+                        {
+                            hill_key sub{ block };
+
+                            for( auto i = 0; i < block; ++i )
+                            {
+                                for( auto j = 0; j < block; ++j )
+                                {
+                                    sub[i][j] = key[start + i][start + j];
+                                }
+                            }
+
+                            // Blocks cannot be split further, but may still be triangular, etc.
+                            auto const sub_inv = structured_inverse(sub, analyze(sub));
+
+                            for( auto i = 0; i < block; ++i )
+                            {
+                                for( auto j = 0; j < block; ++j )
+                                {
+                                    inv[start + i][start + j] = sub_inv[i][j];
+                                }
+                            }
+
+                            start += block;
+                        }
+
+                        return inv;
+                    }
+
+                    default:
+                        return key.inverse();
+                }
+            }
+
+            /** \struct prepared_direction
+                \brief A key matrix with its structure, a kernel chosen for it, and the contribution of trailing padding to its product.
+             */
+            struct prepared_direction
+            {
+                hill_key matrix{ 1 };
+                key_analysis analysis;
+
+                /** \property pad_suffix
+                    \brief pad_suffix[m][i] is the sum over j >= m of matrix[i][j] * pad, i.e.
+                           row i of the product for a block whose last size - m symbols are padding.
+                 */
+                std::vector<msg_block> pad_suffix;
+
+                /** \property dense
+                    \brief Row-major values, for the dense kernel.
+                 */
+                std::vector<std::uint32_t> dense;
+
+                /** \property row_begin
+                    \brief For the span kernel (triangular and block diagonal keys), row i only has nonzeros in [row_begin[i], row_end[i]).
+                 */
+                std::vector<std::size_t> row_begin;
+                std::vector<std::size_t> row_end;
+
+                /** \property values
+                    \brief For the compressed kernel (diagonal, permutation and sparse keys), row i's nonzeros are values[k] at
+                           columns[k] for k in [row_start[i], row_start[i + 1]).
+                 */
+                std::vector<std::uint32_t> values;
+                std::vector<std::uint32_t> columns;
+                std::vector<std::size_t> row_start;
+
+                explicit prepared_direction(hill_key key)
+                    : prepared_direction{ key, analyze(key) }
+                {
+                }
+
+                prepared_direction(hill_key key, key_analysis structure)
+                    : matrix{ std::move(key) }, analysis{ std::move(structure) }
+                {
+                    std::int64_t size = matrix.row_count();
+                    z97 const pad = char_to_z97(' ');
+
+                    pad_suffix.assign(size + 1, msg_block(size));
+
+                    for( auto m = size - 1; m >= 0; --m )
+                    {
+                        for( auto i = 0; i < size; ++i )
+                        {
+                            pad_suffix[m][i] = pad_suffix[m + 1][i] + matrix[i][m] * pad;
+                        }
+                    }
+
+                    dense = flatten(matrix);
+
+                    switch( analysis.structure )
+                    {
+                        case key_structure::upper_triangular:
+                        case key_structure::lower_triangular:
+                        case key_structure::block_diagonal:
+                            for( auto i = 0; i < size; ++i )
+                            {
+                                std::int64_t first = size, last = 0;
+
+                                for( auto j = 0; j < size; ++j )
+                                {
+                                    if( dense[i * size + j] != 0 )
+                                    {
+                                        first = std::min<std::int64_t>(first, j);
+                                        last = j + 1;
+                                    }
+                                }
+
+                                row_begin.push_back(static_cast<std::size_t>(std::min(first, last)));
+                                row_end.push_back(static_cast<std::size_t>(last));
+                            }
+                            break;
+
+                        case key_structure::diagonal:
+                        case key_structure::permutation:
+                        case key_structure::sparse:
+                            row_start.push_back(0);
+
+                            for( auto i = 0; i < size; ++i )
+                            {
+                                for( auto j = 0; j < size; ++j )
+                                {
+                                    if( dense[i * size + j] != 0 )
+                                    {
+                                        values.push_back(dense[i * size + j]);
+                                        columns.push_back(static_cast<std::uint32_t>(j));
+                                    }
+                                }
+
+                                row_start.push_back(values.size());
+                            }
+                            break;
+
+                        default:
+                            break;
+                    }
+                }
+
+                /** \fn auto multiply(std::uint32_t const *x, std::uint32_t *y) const -> void
+                    \brief y = matrix * x with the kernel chosen for the key's structure.
+                 */
+                auto multiply(std::uint32_t const *x, std::uint32_t *y) const -> void
+                {
+                    auto const size = static_cast<std::size_t>(matrix.row_count());
+
+                    if( !row_start.empty() )
+                    {
+                        for( auto i = 0u; i < size; ++i )
+                        {
+                            std::uint32_t sum = 0;
+                            auto const first = row_start[i], last = row_start[i + 1];
+
+                            for( auto k = first; k < last; ++k )
+                            {
+                                sum += values[k] * x[columns[k]];
+                            }
+
+                            y[i] = sum % 97;
+                        }
+                    }
+                    else if( !row_begin.empty() )
+                    {
+                        for( auto i = 0u; i < size; ++i )
+                        {
+                            std::uint32_t sum = 0;
+                            auto const row = dense.data() + i * size;
+                            auto const first = row_begin[i], last = row_end[i];
+
+                            for( auto j = first; j < last; ++j )
+                            {
+                                sum += row[j] * x[j];
+                            }
+
+                            y[i] = sum % 97;
+                        }
+                    }
+                    else
+                    {
+                        multiply_lazy(dense.data(), x, y, size);
+                    }
+                }
+
+                /** \fn auto apply(std::string const &in) const -> std::string
+                    \brief Pads and multiplies like encrypt(), but only multiplies the real symbols of the final block.
+                 */
+                auto apply(std::string const &in) const -> std::string
+                {
+                    std::int64_t size = matrix.row_count();
+
+                    auto const full = in.length() / size;
+                    auto const tail = static_cast<std::int64_t>(in.length() % size);
+
+                    std::string out;
+                    out.resize(full * size + (tail != 0 ? size : 0));
+
+                    std::vector<std::uint32_t> x(size), y(size);
+
+                    for( std::size_t offset = 0; offset < full * size; offset += size )
+                    {
+                        for( auto j = 0; j < size; ++j )
+                        {
+                            x[j] = static_cast<std::uint32_t>(char_to_z97(in[offset + j]).value());
+                        }
+
+                        multiply(x.data(), y.data());
+
+                        for( auto j = 0; j < size; ++j )
+                        {
+                            out[offset + j] = ch_table[y[j]];
+                        }
+                    }
+
+                    if( tail != 0 )
+                    {
+                        auto const offset = full * static_cast<std::size_t>(size);
+
+                        for( auto j = 0; j < tail; ++j )
+                        {
+                            x[j] = static_cast<std::uint32_t>(char_to_z97(in[offset + j]).value());
+                        }
+
+                        // The padding columns are already summed up in pad_suffix[tail].
+                        for( auto i = 0; i < size; ++i )
+                        {
+                            auto sum = static_cast<std::uint32_t>(pad_suffix[tail][i].value());
+                            auto const row = dense.data() + i * size;
+
+                            for( auto j = 0; j < tail; ++j )
+                            {
+                                sum += row[j] * x[j];
+                            }
+
+                            out[offset + i] = ch_table[sum % 97];
+                        }
+                    }
+
+                    return out;
+                }
+            };
+
+            /** \struct inverse_state
+                \brief The lazily computed inverse of a prepared_key, published at most once.
+
+                Holds its own copy of the key until the inverse is published, so that copies of a prepared_key (and the
+                background inverter) can share it without depending on the lifetime of any one key.
+                Foreground callers never wait on the background inverter: each computes the inverse itself if it is not
+                ready, and the first result to finish is the one kept.
+             */
+            struct inverse_state
+            {
+                using clock = std::chrono::steady_clock;
+
+                std::mutex publish;
+                std::mutex foreground;
+                std::optional<prepared_direction> direction;
+                bool singular{ false };
+                std::atomic<bool> ready{ false };
+                std::atomic<std::uint64_t> waits{ 0 };
+
+                clock::time_point prepared_at{ clock::now() };
+                std::chrono::nanoseconds time_to_ready{ 0 };
+                std::chrono::nanoseconds compute_time{ 0 };
+
+                std::shared_ptr<hill_key const> source;
+                key_analysis source_analysis;
+
+                /** \fn inverse_state(hill_key key, key_analysis analysis)
+                    \brief An inverse still to be computed from key.
+                 */
+                inverse_state(hill_key key, key_analysis analysis)
+                    : source{ std::make_shared<hill_key const>(std::move(key)) }, source_analysis{ std::move(analysis) }
+                {
+                }
+
+                /** \fn explicit inverse_state(prepared_direction known)
+                    \brief An inverse that is already known.
+                 */
+                explicit inverse_state(prepared_direction known)
+                    : direction{ std::move(known) }, ready{ true }
+                {
+                }
+
+                inverse_state(inverse_state const &) = delete;
+                auto operator=(inverse_state const &) -> inverse_state & = delete;
+
+                /** \fn auto compute() -> prepared_direction const &
+                    \brief Returns the inverse direction, computing it first if it has not been published. Does not wait
+                           for another computation in progress. Throws std::invalid_argument if the key is not invertible.
+                 */
+                auto compute() -> prepared_direction const &
+                {
+                    std::shared_ptr<hill_key const> key;
+
+                    {
+                        std::lock_guard<std::mutex> lock{ publish };
+
+                        if( ready.load(std::memory_order_relaxed) )
+                        {
+                            return *direction;
+                        }
+
+                        if( singular )
+                        {
+                            throw std::invalid_argument("The matrix is not invertible.\n");
+                        }
+
+                        key = source;
+                    }
+
+                    auto const start = clock::now();
+                    std::optional<prepared_direction> result;
+
+                    // A singular key is remembered, so it is only eliminated once.
+                    try
+                    {
+                        result.emplace(structured_inverse(*key, source_analysis));
+                    }
+                    catch( std::invalid_argument const & )
+                    {
+                    }
+
+                    std::lock_guard<std::mutex> lock{ publish };
+
+                    if( !ready.load(std::memory_order_relaxed) && !singular )
+                    {
+                        source.reset();
+
+                        if( result )
+                        {
+                            auto const now = clock::now();
+                            compute_time = std::chrono::duration_cast<std::chrono::nanoseconds>(now - start);
+                            time_to_ready = std::chrono::duration_cast<std::chrono::nanoseconds>(now - prepared_at);
+                            direction = std::move(result);
+                            ready.store(true, std::memory_order_release);
+                        }
+                        else
+                        {
+                            singular = true;
+                        }
+                    }
+
+                    if( singular )
+                    {
+                        throw std::invalid_argument("The matrix is not invertible.\n");
+                    }
+
+                    return *direction;
+                }
+
+                /** \fn auto get() -> prepared_direction const &
+                    \brief As compute(), counting the calls which found the inverse not ready yet. Concurrent foreground
+                           callers share one computation; the background inverter is never waited for.
+                 */
+                auto get() -> prepared_direction const &
+                {
+                    if( ready.load(std::memory_order_acquire) )
+                    {
+                        return *direction;
+                    }
+
+                    waits.fetch_add(1, std::memory_order_relaxed);
+
+                    std::lock_guard<std::mutex> lock{ foreground };
+
+                    return compute();
+                }
+            };
+
+            /** \class idle_inverter
+                \brief One process-wide thread, at idle priority where supported, that computes queued inverses in order.
+
+                Only weak references are queued, so a key destroyed before its turn is skipped instead of waited for, and
+                a key destroyed mid-computation leaves the worker to finish and release it.
+             */
+            class idle_inverter
+            {
+                public:
+                    /** \fn static auto instance() -> idle_inverter &
+                        \brief Returns the shared inverter, starting its thread on first use.
+                     */
+                    static auto instance() -> idle_inverter &
+                    {
+                        static idle_inverter inverter;
+                        return inverter;
+                    }
+
+                    idle_inverter(idle_inverter const &) = delete;
+                    auto operator=(idle_inverter const &) -> idle_inverter & = delete;
+
+                    ~idle_inverter()
+                    {
+                        // The thread is detached and owns the queue, so exit never waits on an idle-priority inversion.
+                        {
+                            std::lock_guard<std::mutex> lock{ shared->mutex };
+                            shared->stop = true;
+                        }
+
+                        shared->wake.notify_one();
+                    }
+
+                    /** \fn auto enqueue(std::weak_ptr<inverse_state> state) -> void
+                        \brief Queues an inverse to be computed in the background.
+                     */
+                    auto enqueue(std::weak_ptr<inverse_state> state) -> void
+                    {
+                        {
+                            std::lock_guard<std::mutex> lock{ shared->mutex };
+                            shared->pending.push_back(std::move(state));
+                        }
+
+                        shared->wake.notify_one();
+                    }
+
+                private:
+                    struct queue
+                    {
+                        std::mutex mutex;
+                        std::condition_variable wake;
+                        std::deque<std::weak_ptr<inverse_state>> pending;
+                        bool stop{ false };
+                    };
+
+                    idle_inverter()
+                        : shared{ std::make_shared<queue>() }
+                    {
+                        std::thread{ [work = shared]
+                        {
+#if defined(__linux__)
+                            sched_param param{};
+                            pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+                            for( ;; )
+                            {
+                                std::weak_ptr<inverse_state> next;
+
+                                {
+                                    std::unique_lock<std::mutex> lock{ work->mutex };
+                                    work->wake.wait(lock, [&] { return work->stop || !work->pending.empty(); });
+
+                                    if( work->stop )
+                                    {
+                                        return;
+                                    }
+
+                                    next = std::move(work->pending.front());
+                                    work->pending.pop_front();
+                                }
+
+                                if( auto state = next.lock() )
+                                {
+                                    try
+                                    {
+                                        state->compute();
+                                    }
+                                    catch( std::invalid_argument const & )
+                                    {
+                                        // Not invertible; decrypt() will report it.
+                                    }
+                                }
+                            }
+                        } }.detach();
+                    }
+
+                    std::shared_ptr<queue> shared;
+            };
+
+        } // namespace impl_details
+
+        /** \class prepared_key
+            \brief A key with its inverse and padding contributions computed once, for use across many messages.
+
+            Short messages (much shorter than the key's block size) only cost a multiply by the columns holding real symbols.
+            The key is analyzed when prepared: diagonal, permutation, triangular, block diagonal and sparse keys get
+            specialized multiply kernels and are inverted without a full Gauss-Jordan elimination.
+            The inverse can be computed eagerly, on first use, or in the background (see inversion), so that
+            encrypt-only users never pay for it. Copies share the inverse (and its computation); update() gives the
+            updated key a new one. A moved-from key can only be assigned to or destroyed.
+         */
+        class prepared_key
+        {
+            public:
+                /** \fn prepared_key(hill_key key, inversion when = inversion::eager)
+                    \brief Prepares the key. With inversion::eager, throws std::invalid_argument if the key is not invertible;
+                           otherwise that is reported by the first decrypt() or inverse().
+                 */
+                explicit prepared_key(hill_key key, inversion when = inversion::eager)
+                    : forward{ std::move(key) }, backward{ std::make_shared<impl_details::inverse_state>(forward.matrix, forward.analysis) }
+                {
+                    switch( when )
+                    {
+                        case inversion::eager:
+                            backward->compute();
+                            break;
+
+                        case inversion::lazy:
+                            break;
+
+                        case inversion::background:
+                            impl_details::idle_inverter::instance().enqueue(backward);
+                            break;
+                    }
+                }
+
+                prepared_key(prepared_key const &) = default;
+                auto operator=(prepared_key const &) -> prepared_key & = default;
+
+                prepared_key(prepared_key &&) noexcept = default;
+                auto operator=(prepared_key &&) noexcept -> prepared_key & = default;
+
+                /** \fn auto size() const -> std::int64_t
+                    \brief Returns the block size of the key.
+                 */
+                auto size() const -> std::int64_t
+                {
+                    return forward.matrix.row_count();
+                }
+
+                /** \fn auto key() const -> hill_key const &
+                    \brief Returns the encryption key.
+                 */
+                auto key() const -> hill_key const &
+                {
+                    return forward.matrix;
+                }
+
+                /** \fn auto inverse() const -> hill_key const &
+                    \brief Returns the decryption key, computing it if needed. Throws std::invalid_argument if the key is not invertible.
+                 */
+                auto inverse() const -> hill_key const &
+                {
+                    return backward->get().matrix;
+                }
+
+                /** \fn auto stats() const -> prepared_key_stats
+                    \brief Returns the structure detected in the key and its inverse, which selected their kernels, and
+                           when the inverse became ready.
+                 */
+                auto stats() const -> prepared_key_stats
+                {
+                    prepared_key_stats result;
+                    result.encrypt = forward.analysis;
+                    result.inverse_waits = backward->waits.load(std::memory_order_relaxed);
+
+                    if( backward->ready.load(std::memory_order_acquire) )
+                    {
+                        result.decrypt = backward->direction->analysis;
+                        result.inverse_ready = true;
+                        result.time_to_inverse = backward->time_to_ready;
+                        result.inverse_compute_time = backward->compute_time;
+                    }
+
+                    return result;
+                }
+
+                /** \fn auto encrypt(std::string const &pt) const -> std::string
+                    \brief Same result as hill_cipher::encrypt(key(), pt).
+                 */
+                auto encrypt(std::string const &pt) const -> std::string
+                {
+                    return forward.apply(pt);
+                }
+
+                /** \fn auto decrypt(std::string const &ct) const -> std::string
+                    \brief Same result as hill_cipher::decrypt(key(), ct).
+                 */
+                auto decrypt(std::string const &ct) const -> std::string
+                {
+                    return backward->get().apply(ct);
+                }
+
+                /** \fn auto update(std::vector<msg_block> const &u, std::vector<msg_block> const &v) -> void
+                    \brief Applies the rank-k update K += u_1 v_1^T + ... + u_k v_k^T, updating the inverse in O(k n^2)
+                           with the Sherman-Morrison-Woodbury formula instead of recomputing it.
+
+                    Throws std::invalid_argument, leaving the key unchanged, if the updated key would be singular.
+                 */
+                auto update(std::vector<msg_block> const &u, std::vector<msg_block> const &v) -> void
+                {
+                    std::int64_t size = this->size();
+                    std::int64_t rank = static_cast<std::int64_t>(u.size());
+
+                    if( u.size() != v.size() )
+                    {
+                        throw std::invalid_argument("The update needs as many u vectors as v vectors.\n");
+                    }
+
+                    for( auto i = 0; i < rank; ++i )
+                    {
+                        if( static_cast<std::int64_t>(u[i].size()) != size || static_cast<std::int64_t>(v[i].size()) != size )
+                        {
+                            throw std::invalid_argument("The update vectors must have the same size as the key.\n");
+                        }
+                    }
+
+                    if( rank == 0 )
+                    {
+                        return;
+                    }
+
+                    auto const &inv = inverse();
+
+                    // x[i] = K^{-1} u_i and y[i] = v_i^T K^{-1}.
+                    std::vector<msg_block> x(rank, msg_block(size)), y(rank, msg_block(size));
+
+                    for( auto i = 0; i < rank; ++i )
+                    {
+                        for( auto r = 0; r < size; ++r )
+                        {
+                            z97 sum{ 0 };
+
+                            for( auto c = 0; c < size; ++c )
+                            {
+                                sum += inv[r][c] * u[i][c];
+                                y[i][c] += v[i][r] * inv[r][c];
+                            }
+
+                            x[i][r] = sum;
+                        }
+                    }
+
+                    // The capacitance matrix I + V^T K^{-1} U is singular exactly when the updated key is.
+                    hill_key capacitance{ rank };
+
+                    for( auto i = 0; i < rank; ++i )
+                    {
+                        for( auto j = 0; j < rank; ++j )
+                        {
+                            z97 sum{ i == j ? 1 : 0 };
+
+                            for( auto r = 0; r < size; ++r )
+                            {
+                                sum += v[i][r] * x[j][r];
+                            }
+
+                            capacitance[i][j] = sum;
+                        }
+                    }
+
+                    auto const cap_inv = capacitance.inverse();
+
+                    // w = (I + V^T K^{-1} U)^{-1} * (V^T K^{-1}), a k x n matrix.
+                    std::vector<msg_block> w(rank, msg_block(size));
+
+                    for( auto i = 0; i < rank; ++i )
+                    {
+                        for( auto j = 0; j < rank; ++j )
+                        {
+                            for( auto c = 0; c < size; ++c )
+                            {
+                                w[i][c] += cap_inv[i][j] * y[j][c];
+                            }
+                        }
+                    }
+
+                    // K^{-1} -= (K^{-1} U) w, and K += U V^T.
+                    auto new_key{ forward.matrix };
+                    auto new_inv{ inv };
+
+                    for( auto r = 0; r < size; ++r )
+                    {
+                        for( auto i = 0; i < rank; ++i )
+                        {
+                            for( auto c = 0; c < size; ++c )
+                            {
+                                new_inv[r][c] -= x[i][r] * w[i][c];
+                                new_key[r][c] += u[i][r] * v[i][c];
+                            }
+                        }
+                    }
+
+                    auto state = std::make_shared<impl_details::inverse_state>(impl_details::prepared_direction{ std::move(new_inv) });
+
+                    forward = impl_details::prepared_direction{ std::move(new_key) };
+                    backward = std::move(state);
+                }
+
+                /** \fn auto replace_rows(std::vector<std::int64_t> const &rows, std::vector<msg_block> const &values) -> void
+                    \brief Replaces the given (distinct) rows of the key with values, as a low-rank update().
+                 */
+                auto replace_rows(std::vector<std::int64_t> const &rows, std::vector<msg_block> const &values) -> void
+                {
+                    std::int64_t size = this->size();
+
+                    if( rows.size() != values.size() )
+                    {
+                        throw std::invalid_argument("Each replaced row needs exactly one value.\n");
+                    }
+
+                    std::vector<msg_block> u, v;
+
+                    for( auto i = 0u; i < rows.size(); ++i )
+                    {
+                        if( rows[i] < 0 || rows[i] >= size || static_cast<std::int64_t>(values[i].size()) != size )
+                        {
+                            throw std::invalid_argument("Replaced rows must exist and have the same size as the key.\n");
+                        }
+
+                        if( std::find(rows.begin(), rows.begin() + i, rows[i]) != rows.begin() + i )
+                        {
+                            throw std::invalid_argument("A row can only be replaced once per update.\n");
+                        }
+
+                        // Row r becomes values[i]: add e_r (values[i] - K[r])^T.
+                        msg_block e(size), delta(size);
+                        e[rows[i]] = 1;
+
+                        for( auto c = 0; c < size; ++c )
+                        {
+                            delta[c] = values[i][c] - forward.matrix[rows[i]][c];
+                        }
+
+                        u.push_back(std::move(e));
+                        v.push_back(std::move(delta));
+                    }
+
+                    update(u, v);
+                }
+
+            private:
+                impl_details::prepared_direction forward;
+                std::shared_ptr<impl_details::inverse_state> backward;
+        };
+
+    } // namespace hill_cipher
+
+} // namespace math_nerd
+#endif // MATH_NERD_HILL_PREPARED_KEY_H
@@ -0,0 +1,375 @@
+#pragma once
+#ifndef MATH_NERD_HILL_ROUNDS_H
+#define MATH_NERD_HILL_ROUNDS_H
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+#include <math_nerd/hill_cipher.h>
+
+/** \file hill_rounds.h
+    \brief A multi-round Hill construction: each round is a Hill multiply, a nonlinear S-box over GF(97), and a symbol permutation.
+ */
+
+namespace math_nerd
+{
+    namespace hill_cipher
+    {
+        namespace impl_details
+        {
+            /** \fn constexpr auto make_sbox() -> std::array<std::uint8_t, 97>
+                \brief S(x) = 5 * x^{-1} + 42 over GF(97), with 0^{-1} taken to be 0 (as in the AES S-box).
+             */
+            constexpr auto make_sbox() -> std::array<std::uint8_t, 97>
+            {
+                std::array<std::uint8_t, 97> table{};
+
+                for( std::uint32_t x = 0; x < 97; ++x )
+                {
+                    // x^{-1} = x^95 by Fermat's little theorem.
+                    std::uint32_t inv = 1, base = x, exp = 95;
+
+                    while( exp != 0 )
+                    {
+                        if( exp & 1 )
+                        {
+                            inv = inv * base % 97;
+                        }
+
+                        base = base * base % 97;
+                        exp >>= 1;
+                    }
+
+                    table[x] = static_cast<std::uint8_t>((5 * (x == 0 ? 0 : inv) + 42) % 97);
+                }
+
+                return table;
+            }
+
+            /** \fn constexpr auto invert_table(std::array<std::uint8_t, 97> const &table) -> std::array<std::uint8_t, 97>
+                \brief Returns the inverse of a permutation of 0..96.
+             */
+            constexpr auto invert_table(std::array<std::uint8_t, 97> const &table) -> std::array<std::uint8_t, 97>
+            {
+                std::array<std::uint8_t, 97> inverse{};
+
+                for( std::uint8_t x = 0; x < 97; ++x )
+                {
+                    inverse[table[x]] = x;
+                }
+
+                return inverse;
+            }
+
+            /** \property sbox
+                \brief The round S-box.
+             */
+            constexpr std::array<std::uint8_t, 97> sbox = make_sbox();
+
+            /** \property inv_sbox
+                \brief The inverse of the round S-box.
+             */
+            constexpr std::array<std::uint8_t, 97> inv_sbox = invert_table(sbox);
+
+            /** \fn constexpr auto pad_table(std::array<std::uint8_t, 97> const &table) -> std::array<std::uint8_t, 112>
+                \brief Pads a table to seven 16-entry pieces, the size of a pshufb lookup.
+             */
+            constexpr auto pad_table(std::array<std::uint8_t, 97> const &table) -> std::array<std::uint8_t, 112>
+            {
+                std::array<std::uint8_t, 112> padded{};
+
+                for( auto x = 0u; x < table.size(); ++x )
+                {
+                    padded[x] = table[x];
+                }
+
+                return padded;
+            }
+
+            /** \property sbox_pieces
+                \brief The S-box, padded for substitute().
+             */
+            constexpr std::array<std::uint8_t, 112> sbox_pieces = pad_table(sbox);
+
+            /** \property inv_sbox_pieces
+                \brief The inverse S-box, padded for substitute().
+             */
+            constexpr std::array<std::uint8_t, 112> inv_sbox_pieces = pad_table(inv_sbox);
+
+            /** \fn auto substitute(std::array<std::uint8_t, 112> const &table, std::uint8_t *data, std::size_t length) -> void
+                \brief data[i] = table[data[i]] for residues in [0, 97), 16 symbols per lookup where SSSE3 is available.
+             */
+            auto substitute(std::array<std::uint8_t, 112> const &table, std::uint8_t *data, std::size_t length) -> void
+            {
+                std::size_t i = 0;
+
+#if defined(__SSSE3__)
+                // For piece k, x - 16k is a pshufb index only for x in [16k, 16k + 16). Smaller x wrap around to bytes
+                // with the high bit set and larger x are forced to 0xFF; pshufb maps both to 0, so OR-ing the seven
+                // lookups selects exactly one entry.
+                __m128i pieces[7];
+
+                for( auto k = 0; k < 7; ++k )
+                {
+                    pieces[k] = _mm_loadu_si128(reinterpret_cast<__m128i const *>(table.data() + 16 * k));
+                }
+
+                auto const fifteen = _mm_set1_epi8(15);
+
+                for( ; i + 16 <= length; i += 16 )
+                {
+                    auto const x = _mm_loadu_si128(reinterpret_cast<__m128i const *>(data + i));
+                    auto result = _mm_setzero_si128();
+
+                    for( auto k = 0; k < 7; ++k )
+                    {
+                        auto index = _mm_sub_epi8(x, _mm_set1_epi8(static_cast<char>(16 * k)));
+                        index = _mm_or_si128(index, _mm_cmpgt_epi8(index, fifteen));
+                        result = _mm_or_si128(result, _mm_shuffle_epi8(pieces[k], index));
+                    }
+
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(data + i), result);
+                }
+#endif
+
+                for( ; i < length; ++i )
+                {
+                    data[i] = table[data[i]];
+                }
+            }
+
+        } // namespace impl_details
+
+        /** \class round_cipher
+            \brief Multi-round Hill cipher. Round r maps a block x to P_r(S(K_r * x)), where S is applied per symbol.
+
+            All rounds of a block run in one fused kernel, so the block stays in a small working buffer across rounds.
+            Blocks of any size are supported, so that buffer lives in memory rather than in registers; the S-box is
+            applied 16 symbols at a time with pshufb when compiled with SSSE3.
+         */
+        class round_cipher
+        {
+            public:
+                /** \fn round_cipher(std::vector<hill_key> const &keys, std::vector<std::vector<std::size_t>> permutations)
+                    \brief One round per key/permutation. Throws std::invalid_argument if a key is not invertible,
+                           the sizes differ, or a permutation is not a permutation of 0..size-1.
+                 */
+                round_cipher(std::vector<hill_key> const &keys, std::vector<std::vector<std::size_t>> permutations)
+                    : perms{ std::move(permutations) }
+                {
+                    if( keys.empty() || keys.size() != perms.size() )
+                    {
+                        throw std::invalid_argument("Each round needs exactly one key and one permutation.\n");
+                    }
+
+                    block = keys.front().row_count();
+
+                    for( auto r = 0u; r < keys.size(); ++r )
+                    {
+                        if( keys[r].row_count() != block || perms[r].size() != static_cast<std::size_t>(block) )
+                        {
+                            throw std::invalid_argument("All round keys and permutations must have the same size.\n");
+                        }
+
+                        auto sorted = perms[r];
+                        std::sort(sorted.begin(), sorted.end());
+
+                        for( auto i = 0u; i < sorted.size(); ++i )
+                        {
+                            if( sorted[i] != i )
+                            {
+                                throw std::invalid_argument("A round permutation is not a permutation.\n");
+                            }
+                        }
+
+                        auto inverse_key = keys[r].inverse();
+
+                        std::vector<std::size_t> inverse_perm(block);
+                        for( auto i = 0u; i < perms[r].size(); ++i )
+                        {
+                            inverse_perm[perms[r][i]] = i;
+                        }
+
+                        forward.push_back(impl_details::flatten(keys[r]));
+                        backward.push_back(impl_details::flatten(inverse_key));
+                        inv_perms.push_back(std::move(inverse_perm));
+                    }
+                }
+
+                /** \fn static auto generate(std::int64_t size, std::size_t rounds, std::uint64_t seed) -> round_cipher
+                    \brief Generates random invertible round keys and permutations from a seed.
+                 */
+                static auto generate(std::int64_t size, std::size_t rounds, std::uint64_t seed) -> round_cipher
+                {
+                    std::mt19937_64 rng{ seed };
+                    std::uniform_int_distribution<std::int64_t> symbol{ 0, 96 };
+
+                    std::vector<hill_key> keys;
+                    std::vector<std::vector<std::size_t>> permutations;
+
+                    while( keys.size() < rounds )
+                    {
+                        hill_key key{ size };
+
+                        for( auto i = 0; i < size; ++i )
+                        {
+                            for( auto j = 0; j < size; ++j )
+                            {
+                                key[i][j] = symbol(rng);
+                            }
+                        }
+
+                        if( !is_valid_key(key) )
+                        {
+                            continue;
+                        }
+
+                        std::vector<std::size_t> perm(size);
+                        std::iota(perm.begin(), perm.end(), std::size_t{ 0 });
+                        std::shuffle(perm.begin(), perm.end(), rng);
+
+                        keys.push_back(std::move(key));
+                        permutations.push_back(std::move(perm));
+                    }
+
+                    return round_cipher{ keys, std::move(permutations) };
+                }
+
+                /** \fn auto size() const -> std::int64_t
+                    \brief Returns the block size.
+                 */
+                auto size() const -> std::int64_t
+                {
+                    return block;
+                }
+
+                /** \fn auto rounds() const -> std::size_t
+                    \brief Returns the number of rounds.
+                 */
+                auto rounds() const -> std::size_t
+                {
+                    return forward.size();
+                }
+
+                /** \fn auto encrypt(std::string pt) const -> std::string
+                    \brief Pads the plaintext with spaces to a multiple of the block size and encrypts it.
+                 */
+                auto encrypt(std::string pt) const -> std::string
+                {
+                    using namespace impl_details;
+
+                    auto const n = static_cast<std::size_t>(block);
+
+                    // Pad plaintext to make its length a multiple of size
+                    while( (pt.length() % n) != 0 )
+                    {
+                        pt += ' ';
+                    }
+
+                    std::string ct;
+                    ct.resize(pt.size());
+
+                    std::vector<std::uint32_t> x(n), y(n);
+                    std::vector<std::uint8_t> s(n);
+
+                    for( std::size_t offset = 0; offset < pt.length(); offset += n )
+                    {
+                        for( auto j = 0u; j < n; ++j )
+                        {
+                            x[j] = static_cast<std::uint32_t>(char_to_z97(pt[offset + j]).value());
+                        }
+
+                        for( auto r = 0u; r < forward.size(); ++r )
+                        {
+                            multiply_lazy(forward[r].data(), x.data(), y.data(), n);
+
+                            // x_i = S(y_{P(i)}): substitute the whole block, then permute.
+                            std::copy(y.begin(), y.end(), s.begin());
+                            substitute(sbox_pieces, s.data(), n);
+
+                            auto const &perm = perms[r];
+                            for( auto i = 0u; i < n; ++i )
+                            {
+                                x[i] = s[perm[i]];
+                            }
+                        }
+
+                        for( auto j = 0u; j < n; ++j )
+                        {
+                            ct[offset + j] = ch_table[x[j]];
+                        }
+                    }
+
+                    return ct;
+                }
+
+                /** \fn auto decrypt(std::string ct) const -> std::string
+                    \brief Inverts encrypt(), running the rounds backwards.
+                 */
+                auto decrypt(std::string ct) const -> std::string
+                {
+                    using namespace impl_details;
+
+                    auto const n = static_cast<std::size_t>(block);
+
+                    while( (ct.length() % n) != 0 )
+                    {
+                        ct += ' ';
+                    }
+
+                    std::string pt;
+                    pt.resize(ct.size());
+
+                    std::vector<std::uint32_t> x(n), y(n);
+                    std::vector<std::uint8_t> s(n);
+
+                    for( std::size_t offset = 0; offset < ct.length(); offset += n )
+                    {
+                        for( auto j = 0u; j < n; ++j )
+                        {
+                            x[j] = static_cast<std::uint32_t>(char_to_z97(ct[offset + j]).value());
+                        }
+
+                        for( auto r = forward.size(); r-- > 0; )
+                        {
+                            auto const &inv_perm = inv_perms[r];
+                            for( auto i = 0u; i < n; ++i )
+                            {
+                                s[i] = static_cast<std::uint8_t>(x[inv_perm[i]]);
+                            }
+
+                            substitute(inv_sbox_pieces, s.data(), n);
+                            std::copy(s.begin(), s.end(), y.begin());
+
+                            multiply_lazy(backward[r].data(), y.data(), x.data(), n);
+                        }
+
+                        for( auto j = 0u; j < n; ++j )
+                        {
+                            pt[offset + j] = ch_table[x[j]];
+                        }
+                    }
+
+                    return pt;
+                }
+
+            private:
+                std::int64_t block{ 0 };
+                std::vector<std::vector<std::uint32_t>> forward;
+                std::vector<std::vector<std::uint32_t>> backward;
+                std::vector<std::vector<std::size_t>> perms;
+                std::vector<std::vector<std::size_t>> inv_perms;
+        };
+
+    } // namespace hill_cipher
+
+} // namespace math_nerd
+#endif // MATH_NERD_HILL_ROUNDS_H
@@ -0,0 +1,514 @@
+#pragma once
+#ifndef MATH_NERD_HILL_SOCKET_H
+#define MATH_NERD_HILL_SOCKET_H
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <math_nerd/hill_cipher.h>
+
+/** \file hill_socket.h
+    \brief An encrypting wrapper for connected stream sockets (Unix domain or TCP), with block-aligned framing.
+
+    Each frame is a 4-byte little-endian payload length followed by the payload, padded with spaces to a whole number
+    of blocks and encrypted like encrypt(). As with encrypt(), payloads should only contain characters from the
+    character table.
+ */
+
+namespace math_nerd
+{
+    namespace hill_cipher
+    {
+        /** \struct socket_options
+            \brief Framing and queueing limits of an encrypted_socket. Both ends should use the same max_frame.
+         */
+        struct socket_options
+        {
+            /** \property max_frame
+                \brief Largest payload carried by one frame; longer sends are split.
+             */
+            std::size_t max_frame{ 1 << 16 };
+
+            /** \property max_queued_frames
+                \brief Frames allowed to wait for send() or receive() before the other side blocks.
+             */
+            std::size_t max_queued_frames{ 64 };
+        };
+
+        /** \struct socket_stats
+            \brief What an encrypted_socket has done so far.
+         */
+        struct socket_stats
+        {
+            std::uint64_t frames_sent{ 0 };
+            std::uint64_t frames_received{ 0 };
+            std::uint64_t payload_bytes_sent{ 0 };
+            std::uint64_t payload_bytes_received{ 0 };
+
+            /** \property send_calls
+                \brief Number of sendmsg() calls; queued frames are sent together, so usually fewer than frames_sent.
+             */
+            std::uint64_t send_calls{ 0 };
+            std::uint64_t recv_calls{ 0 };
+        };
+
+        namespace impl_details
+        {
+            /** \struct socket_frame
+                \brief A frame as it travels: the payload length and the encrypted, padded payload.
+             */
+            struct socket_frame
+            {
+                std::size_t length{ 0 };
+                std::string data;
+            };
+
+            /** \fn auto frame_header(std::size_t length) -> std::string
+                \brief Encodes a payload length as the 4-byte little-endian frame header.
+             */
+            auto frame_header(std::size_t length) -> std::string
+            {
+                std::string header(4, '\0');
+
+                for( auto i = 0u; i < 4; ++i )
+                {
+                    header[i] = static_cast<char>((length >> (8 * i)) & 0xFF);
+                }
+
+                return header;
+            }
+
+            /** \fn auto parse_frame_header(char const *header) -> std::size_t
+                \brief Decodes a 4-byte little-endian frame header.
+             */
+            auto parse_frame_header(char const *header) -> std::size_t
+            {
+                std::size_t length = 0;
+
+                for( auto i = 0u; i < 4; ++i )
+                {
+                    length |= static_cast<std::size_t>(static_cast<unsigned char>(header[i])) << (8 * i);
+                }
+
+                return length;
+            }
+
+        } // namespace impl_details
+
+        /** \class encrypted_socket
+            \brief Sends and receives encrypted, block-aligned frames over a connected stream socket, which it takes
+                   ownership of.
+
+            Encryption and decryption overlap with I/O: send() encrypts on the caller's thread while a writer thread
+            sends earlier frames, gathering everything queued into one sendmsg(); a reader thread receives in large
+            chunks and splits them into frames, which receive() decrypts in batches. One thread may send while another
+            receives, but each side must only be used from one thread at a time.
+         */
+        class encrypted_socket
+        {
+            public:
+                /** \fn encrypted_socket(int fd, hill_key const &key, socket_options options = {})
+                    \brief Wraps the connected socket fd. Throws std::invalid_argument if the key is not invertible.
+
+                    The socket is closed if construction throws, so ownership of fd passes to the call either way.
+                 */
+                encrypted_socket(int fd, hill_key const &key, socket_options options = {})
+                try
+                    : fd{ fd }, size{ static_cast<std::size_t>(key.row_count()) }, options{ options },
+                      forward{ impl_details::flatten(key) }, backward{ impl_details::flatten(key.inverse()) }
+                {
+                    // Keep frames block-aligned, with lengths that fit the header.
+                    this->options.max_frame = std::max(size, std::min<std::size_t>(this->options.max_frame, 0xFFFFFFFF) / size * size);
+                    this->options.max_queued_frames = std::max<std::size_t>(1, this->options.max_queued_frames);
+
+                    writer = std::thread{ [this] { write_frames(); } };
+
+                    try
+                    {
+                        reader = std::thread{ [this] { read_frames(); } };
+                    }
+                    catch( ... )
+                    {
+                        {
+                            std::lock_guard<std::mutex> lock{ mutex };
+                            stopping = true;
+                        }
+
+                        outgoing_ready.notify_all();
+                        writer.join();
+                        throw;
+                    }
+                }
+                catch( ... )
+                {
+                    // The parameter, not the member: members are already destroyed here.
+                    ::close(fd);
+                }
+
+                encrypted_socket(encrypted_socket const &) = delete;
+                auto operator=(encrypted_socket const &) -> encrypted_socket & = delete;
+
+                /** \fn ~encrypted_socket()
+                    \brief Sends any queued frames, then shuts down and closes the socket.
+                 */
+                ~encrypted_socket()
+                {
+                    {
+                        std::lock_guard<std::mutex> lock{ mutex };
+                        stopping = true;
+                    }
+
+                    outgoing_ready.notify_all();
+                    incoming_ready.notify_all();
+                    writer.join();
+
+                    // Wakes the reader if it is blocked in recv().
+                    ::shutdown(fd, SHUT_RDWR);
+                    reader.join();
+
+                    ::close(fd);
+                }
+
+                /** \fn auto send(std::string_view data) -> void
+                    \brief Encrypts data into one frame (or several, if longer than max_frame) and queues it for sending.
+
+                    Blocks while max_queued_frames are waiting. Rethrows any error the writer thread hit.
+                 */
+                auto send(std::string_view data) -> void
+                {
+                    for( std::size_t offset = 0; offset < data.size(); offset += options.max_frame )
+                    {
+                        auto const length = std::min(options.max_frame, data.size() - offset);
+                        auto const padded = (length + size - 1) / size * size;
+
+                        auto frame = impl_details::frame_header(length);
+                        frame.append(data.substr(offset, length));
+                        frame.append(padded - length, ' ');
+
+                        impl_details::transform_in_place(forward.data(), frame.data() + 4, padded, size);
+
+                        std::unique_lock<std::mutex> lock{ mutex };
+                        frame_sent.wait(lock, [this] { return outgoing.size() < options.max_queued_frames || send_error; });
+
+                        if( send_error )
+                        {
+                            std::rethrow_exception(send_error);
+                        }
+
+                        outgoing.push_back({ length, std::move(frame) });
+                        lock.unlock();
+
+                        outgoing_ready.notify_one();
+                    }
+                }
+
+                /** \fn auto flush() -> void
+                    \brief Waits until every queued frame has been handed to the socket. Rethrows any error the writer thread hit.
+                 */
+                auto flush() -> void
+                {
+                    std::unique_lock<std::mutex> lock{ mutex };
+                    frame_sent.wait(lock, [this] { return (outgoing.empty() && !writing) || send_error; });
+
+                    if( send_error )
+                    {
+                        std::rethrow_exception(send_error);
+                    }
+                }
+
+                /** \fn auto shutdown_send() -> void
+                    \brief Flushes, then shuts down the sending side so the peer's receive() returns std::nullopt.
+                 */
+                auto shutdown_send() -> void
+                {
+                    flush();
+                    ::shutdown(fd, SHUT_WR);
+                }
+
+                /** \fn auto receive() -> std::optional<std::string>
+                    \brief Returns the payload of the next frame, or std::nullopt once the peer has shut down its sending
+                           side. Throws std::system_error on socket errors and std::runtime_error on malformed frames.
+                 */
+                auto receive() -> std::optional<std::string>
+                {
+                    if( decrypted.empty() )
+                    {
+                        std::deque<impl_details::socket_frame> batch;
+
+                        {
+                            std::unique_lock<std::mutex> lock{ mutex };
+                            incoming_ready.wait(lock, [this] { return !incoming.empty() || receive_done; });
+
+                            if( incoming.empty() )
+                            {
+                                if( receive_error )
+                                {
+                                    std::rethrow_exception(receive_error);
+                                }
+
+                                return std::nullopt;
+                            }
+
+                            batch.swap(incoming);
+                        }
+
+                        incoming_ready.notify_all();
+
+                        // Decrypt everything that has arrived while the reader keeps receiving.
+                        for( auto &frame : batch )
+                        {
+                            impl_details::transform_in_place(backward.data(), frame.data.data(), frame.data.size(), size);
+                            frame.data.resize(frame.length);
+                        }
+
+                        decrypted.swap(batch);
+                    }
+
+                    auto payload = std::move(decrypted.front().data);
+                    decrypted.pop_front();
+
+                    return payload;
+                }
+
+                /** \fn auto stats() const -> socket_stats
+                    \brief Returns the frame, byte and system call counts so far.
+                 */
+                auto stats() const -> socket_stats
+                {
+                    std::lock_guard<std::mutex> lock{ mutex };
+                    return counters;
+                }
+
+            private:
+                auto write_frames() -> void
+                {
+                    std::vector<iovec> iov;
+
+                    for( ;; )
+                    {
+                        std::deque<impl_details::socket_frame> batch;
+
+                        {
+                            std::unique_lock<std::mutex> lock{ mutex };
+                            outgoing_ready.wait(lock, [this] { return stopping || !outgoing.empty(); });
+
+                            if( outgoing.empty() || send_error )
+                            {
+                                return;
+                            }
+
+                            batch.swap(outgoing);
+                            writing = true;
+                        }
+
+                        frame_sent.notify_all();
+
+                        std::uint64_t calls = 0;
+                        std::uint64_t payload = 0;
+                        std::exception_ptr error;
+
+                        iov.clear();
+                        for( auto &frame : batch )
+                        {
+                            iov.push_back({ frame.data.data(), frame.data.size() });
+                            payload += frame.length;
+                        }
+
+                        // Send all queued frames with as few calls as possible, resuming after partial sends.
+                        for( std::size_t first = 0; first < iov.size(); )
+                        {
+                            msghdr message{};
+                            message.msg_iov = iov.data() + first;
+                            message.msg_iovlen = std::min<std::size_t>(iov.size() - first, IOV_MAX);
+
+                            auto sent = ::sendmsg(fd, &message, MSG_NOSIGNAL);
+                            ++calls;
+
+                            if( sent < 0 )
+                            {
+                                if( errno == EINTR )
+                                {
+                                    continue;
+                                }
+
+                                error = std::make_exception_ptr(std::system_error{ errno, std::generic_category(), "encrypted_socket: send" });
+                                break;
+                            }
+
+                            while( first < iov.size() && static_cast<std::size_t>(sent) >= iov[first].iov_len )
+                            {
+                                sent -= static_cast<ssize_t>(iov[first].iov_len);
+                                ++first;
+                            }
+
+                            if( first < iov.size() )
+                            {
+                                iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + sent;
+                                iov[first].iov_len -= static_cast<std::size_t>(sent);
+                            }
+                        }
+
+                        {
+                            std::lock_guard<std::mutex> lock{ mutex };
+                            writing = false;
+                            counters.send_calls += calls;
+
+                            if( error )
+                            {
+                                send_error = error;
+                                outgoing.clear();
+                            }
+                            else
+                            {
+                                counters.frames_sent += batch.size();
+                                counters.payload_bytes_sent += payload;
+                            }
+                        }
+
+                        frame_sent.notify_all();
+                    }
+                }
+
+                auto read_frames() -> void
+                {
+                    std::string buffer;
+                    std::size_t parsed = 0;
+                    std::size_t const chunk = std::max<std::size_t>(1 << 16, options.max_frame + 4);
+                    std::exception_ptr error;
+
+                    for( ;; )
+                    {
+                        auto const kept = buffer.size();
+                        buffer.resize(kept + chunk);
+
+                        auto const got = ::recv(fd, buffer.data() + kept, chunk, 0);
+                        buffer.resize(kept + static_cast<std::size_t>(std::max<ssize_t>(got, 0)));
+
+                        if( got < 0 )
+                        {
+                            if( errno == EINTR )
+                            {
+                                continue;
+                            }
+
+                            error = std::make_exception_ptr(std::system_error{ errno, std::generic_category(), "encrypted_socket: receive" });
+                            break;
+                        }
+
+                        if( got == 0 )
+                        {
+                            if( buffer.size() != parsed )
+                            {
+                                error = std::make_exception_ptr(std::runtime_error("The connection closed in the middle of a frame.\n"));
+                            }
+
+                            break;
+                        }
+
+                        // Split off every complete frame.
+                        std::deque<impl_details::socket_frame> frames;
+
+                        while( buffer.size() - parsed >= 4 )
+                        {
+                            auto const length = impl_details::parse_frame_header(buffer.data() + parsed);
+                            auto const padded = (length + size - 1) / size * size;
+
+                            if( length > options.max_frame )
+                            {
+                                error = std::make_exception_ptr(std::runtime_error("Received a frame longer than max_frame.\n"));
+                                break;
+                            }
+
+                            if( buffer.size() - parsed - 4 < padded )
+                            {
+                                break;
+                            }
+
+                            frames.push_back({ length, buffer.substr(parsed + 4, padded) });
+                            parsed += 4 + padded;
+                        }
+
+                        buffer.erase(0, parsed);
+                        parsed = 0;
+
+                        std::unique_lock<std::mutex> lock{ mutex };
+                        counters.recv_calls += 1;
+
+                        for( auto &frame : frames )
+                        {
+                            counters.frames_received += 1;
+                            counters.payload_bytes_received += frame.length;
+                            incoming.push_back(std::move(frame));
+                        }
+
+                        lock.unlock();
+                        incoming_ready.notify_all();
+
+                        if( error )
+                        {
+                            break;
+                        }
+
+                        lock.lock();
+                        incoming_ready.wait(lock, [this] { return incoming.size() < options.max_queued_frames || stopping; });
+
+                        if( stopping )
+                        {
+                            break;
+                        }
+                    }
+
+                    {
+                        std::lock_guard<std::mutex> lock{ mutex };
+                        receive_error = error;
+                        receive_done = true;
+                    }
+
+                    incoming_ready.notify_all();
+                }
+
+                int fd;
+                std::size_t size;
+                socket_options options;
+                std::vector<std::uint32_t> forward;
+                std::vector<std::uint32_t> backward;
+
+                mutable std::mutex mutex;
+                std::condition_variable outgoing_ready;
+                std::condition_variable frame_sent;
+                std::condition_variable incoming_ready;
+
+                std::deque<impl_details::socket_frame> outgoing;
+                std::deque<impl_details::socket_frame> incoming;
+                std::deque<impl_details::socket_frame> decrypted;
+
+                bool writing{ false };
+                bool stopping{ false };
+                bool receive_done{ false };
+                std::exception_ptr send_error;
+                std::exception_ptr receive_error;
+                socket_stats counters;
+
+                std::thread writer;
+                std::thread reader;
+        };
+
+    } // namespace hill_cipher
+
+} // namespace math_nerd
+#endif // MATH_NERD_HILL_SOCKET_H
@@ -0,0 +1,414 @@
+#pragma once
+#ifndef MATH_NERD_HILL_TRACE_H
+#define MATH_NERD_HILL_TRACE_H
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <math_nerd/hill_cipher.h>
+
+/** \file hill_trace.h
+    \brief Recording pseudonymized traces of cipher calls, and replaying them against an engine as a benchmark.
+
+    A trace file holds one call per line: the nanoseconds since the previous call, the pseudonymized key id, the key size,
+    the payload length and the operation ('e' or 'd'). Lines starting with '#' are ignored. Payloads are never recorded.
+ */
+
+namespace math_nerd
+{
+    namespace hill_cipher
+    {
+        /** \struct trace_record
+            \brief One recorded call.
+         */
+        struct trace_record
+        {
+            /** \property gap
+                \brief Time since the previous call (inter-arrival time).
+             */
+            std::chrono::nanoseconds gap{ 0 };
+
+            /** \property key_id
+                \brief The pseudonymized key id; calls with the same key share it.
+             */
+            std::uint64_t key_id{ 0 };
+
+            std::int64_t key_size{ 0 };
+            std::uint64_t payload_length{ 0 };
+            filter_mode op{ filter_mode::encrypt };
+        };
+
+        /** \name Trace secret
+            \brief The 128-bit SipHash key a trace_recorder pseudonymizes key ids with.
+         */
+        using trace_secret = std::array<std::uint64_t, 2>;
+
+        namespace impl_details
+        {
+            /** \fn auto siphash(trace_secret const &key, std::string_view data) -> std::uint64_t
+                \brief SipHash-2-4 of data under a 128-bit key.
+             */
+            auto siphash(trace_secret const &key, std::string_view data) -> std::uint64_t
+            {
+                auto const rotl = [](std::uint64_t x, int b) { return (x << b) | (x >> (64 - b)); };
+
+                std::uint64_t v0 = 0x736f6d6570736575ULL ^ key[0];
+                std::uint64_t v1 = 0x646f72616e646f6dULL ^ key[1];
+                std::uint64_t v2 = 0x6c7967656e657261ULL ^ key[0];
+                std::uint64_t v3 = 0x7465646279746573ULL ^ key[1];
+
+                auto const round = [&]
+                {
+                    v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+                    v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+                    v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+                    v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+                };
+
+                auto const compress = [&](std::uint64_t m)
+                {
+                    v3 ^= m;
+                    round();
+                    round();
+                    v0 ^= m;
+                };
+
+                // Little-endian 8-byte words; the last word holds the remaining bytes and the length in its top byte.
+                std::size_t i = 0;
+
+                for( ; i + 8 <= data.size(); i += 8 )
+                {
+                    std::uint64_t m = 0;
+
+                    for( auto b = 0; b < 8; ++b )
+                    {
+                        m |= static_cast<std::uint64_t>(static_cast<unsigned char>(data[i + b])) << (8 * b);
+                    }
+
+                    compress(m);
+                }
+
+                std::uint64_t last = static_cast<std::uint64_t>(data.size()) << 56;
+
+                for( auto b = 0; i + b < data.size(); ++b )
+                {
+                    last |= static_cast<std::uint64_t>(static_cast<unsigned char>(data[i + b])) << (8 * b);
+                }
+
+                compress(last);
+
+                v2 ^= 0xff;
+                round();
+                round();
+                round();
+                round();
+
+                return v0 ^ v1 ^ v2 ^ v3;
+            }
+
+            /** \fn auto random_secret() -> trace_secret
+                \brief Draws a fresh 128-bit secret from std::random_device.
+             */
+            auto random_secret() -> trace_secret
+            {
+                std::random_device device;
+
+                auto const draw = [&] { return (static_cast<std::uint64_t>(device()) << 32) | static_cast<std::uint64_t>(device()); };
+
+                return { draw(), draw() };
+            }
+
+        } // namespace impl_details
+
+        /** \class trace_recorder
+            \brief Records calls from any number of threads. Key ids are replaced by a keyed hash (SipHash-2-4 under a
+                   128-bit secret), so a trace shows which calls share a key without revealing key or tenant names.
+
+            This is pseudonymization, not anonymization: calls with the same key stay linkable, and anyone holding the
+            secret can test guessed ids against the trace. Discard the secret once a trace is written.
+         */
+        class trace_recorder
+        {
+            public:
+                /** \fn trace_recorder(trace_secret secret = impl_details::random_secret())
+                    \brief Starts recording; the first call's gap is measured from here.
+                 */
+                explicit trace_recorder(trace_secret secret = impl_details::random_secret())
+                    : secret{ secret }, last{ std::chrono::steady_clock::now() }
+                {
+                }
+
+                /** \fn auto anonymize(std::string_view key_id) const -> std::uint64_t
+                    \brief Returns the keyed hash that stands in for key_id in the trace.
+                 */
+                auto anonymize(std::string_view key_id) const -> std::uint64_t
+                {
+                    return impl_details::siphash(secret, key_id);
+                }
+
+                /** \fn auto record(std::string_view key_id, std::int64_t key_size, std::size_t payload_length, filter_mode op) -> void
+                    \brief Records a call made now.
+                 */
+                auto record(std::string_view key_id, std::int64_t key_size, std::size_t payload_length, filter_mode op) -> void
+                {
+                    auto const id = anonymize(key_id);
+                    auto const now = std::chrono::steady_clock::now();
+
+                    std::lock_guard<std::mutex> lock{ mutex };
+
+                    auto const gap = std::max(std::chrono::nanoseconds{ 0 }, std::chrono::duration_cast<std::chrono::nanoseconds>(now - last));
+                    last = std::max(last, now);
+
+                    records.push_back({ gap, id, key_size, static_cast<std::uint64_t>(payload_length), op });
+                }
+
+                /** \fn auto trace() const -> std::vector<trace_record>
+                    \brief Returns a copy of the calls recorded so far.
+                 */
+                auto trace() const -> std::vector<trace_record>
+                {
+                    std::lock_guard<std::mutex> lock{ mutex };
+                    return records;
+                }
+
+            private:
+                trace_secret secret;
+                std::chrono::steady_clock::time_point last;
+                std::vector<trace_record> records;
+                mutable std::mutex mutex;
+        };
+
+        /** \fn auto write_trace(std::ostream &out, std::vector<trace_record> const &trace) -> void
+            \brief Writes a trace in the trace file format.
+         */
+        auto write_trace(std::ostream &out, std::vector<trace_record> const &trace) -> void
+        {
+            out << "# gap_ns key_id key_size payload_length op\n";
+
+            for( auto const &r : trace )
+            {
+                out << r.gap.count() << ' ' << r.key_id << ' ' << r.key_size << ' ' << r.payload_length << ' ' << (r.op == filter_mode::encrypt ? 'e' : 'd') << '\n';
+            }
+        }
+
+        /** \fn auto read_trace(std::istream &in) -> std::vector<trace_record>
+            \brief Reads a trace file. Throws std::runtime_error on a malformed line, including key sizes above 4096 (as
+                   for load_keys) and payloads over 1 GiB, which replay() would otherwise try to allocate.
+         */
+        auto read_trace(std::istream &in) -> std::vector<trace_record>
+        {
+            std::vector<trace_record> trace;
+            std::string line;
+
+            for( std::size_t number = 1; std::getline(in, line); ++number )
+            {
+                auto const first = line.find_first_not_of(" \t\r");
+
+                if( first == std::string::npos || line[first] == '#' )
+                {
+                    continue;
+                }
+
+                std::istringstream fields{ line };
+                std::int64_t gap = 0;
+                trace_record r;
+                char op = 0;
+                std::string rest;
+
+                if( !(fields >> gap >> r.key_id >> r.key_size >> r.payload_length >> op) || (fields >> rest) || gap < 0 || r.key_size <= 0 || r.key_size > 4096
+                    || r.payload_length > (std::uint64_t{ 1 } << 30) || (op != 'e' && op != 'd') )
+                {
+                    throw std::runtime_error("Malformed trace record on line " + std::to_string(number) + ".\n");
+                }
+
+                r.gap = std::chrono::nanoseconds{ gap };
+                r.op = (op == 'e') ? filter_mode::encrypt : filter_mode::decrypt;
+                trace.push_back(r);
+            }
+
+            return trace;
+        }
+
+        /** \struct replay_options
+            \brief How fast to replay a trace.
+         */
+        struct replay_options
+        {
+            /** \property recorded_speed
+                \brief If true, calls are issued at their recorded inter-arrival times (divided by speedup, which must be
+                       positive); otherwise back to back.
+             */
+            bool recorded_speed{ false };
+            double speedup{ 1.0 };
+        };
+
+        /** \struct replay_report
+            \brief Throughput and latency distribution of a replay.
+         */
+        struct replay_report
+        {
+            std::uint64_t operations{ 0 };
+            std::uint64_t payload_bytes{ 0 };
+            std::chrono::nanoseconds elapsed{ 0 };
+
+            /** \property p50
+                \brief Latency percentiles. At recorded speed, latency runs from the call's scheduled time, so time spent
+                       waiting behind a slow earlier call is counted.
+             */
+            std::chrono::nanoseconds p50{ 0 };
+            std::chrono::nanoseconds p90{ 0 };
+            std::chrono::nanoseconds p99{ 0 };
+            std::chrono::nanoseconds max{ 0 };
+            std::chrono::nanoseconds mean{ 0 };
+
+            auto operations_per_second() const -> double
+            {
+                return elapsed.count() > 0 ? static_cast<double>(operations) * 1e9 / static_cast<double>(elapsed.count()) : 0.0;
+            }
+
+            auto mib_per_second() const -> double
+            {
+                return elapsed.count() > 0 ? static_cast<double>(payload_bytes) * 1e9 / static_cast<double>(elapsed.count()) / (1024.0 * 1024.0) : 0.0;
+            }
+        };
+
+        namespace impl_details
+        {
+            /** \fn auto replay_key(std::uint64_t key_id, std::int64_t key_size) -> hill_key
+                \brief Deterministically generates an invertible key standing in for an anonymized key id.
+             */
+            auto replay_key(std::uint64_t key_id, std::int64_t key_size) -> hill_key
+            {
+                std::mt19937_64 rng{ key_id ^ static_cast<std::uint64_t>(key_size) };
+                std::uniform_int_distribution<std::int64_t> symbol{ 0, 96 };
+
+                hill_key key{ key_size };
+
+                do
+                {
+                    for( auto i = 0; i < key_size; ++i )
+                    {
+                        for( auto j = 0; j < key_size; ++j )
+                        {
+                            key[i][j] = symbol(rng);
+                        }
+                    }
+                } while( !is_valid_key(key) );
+
+                return key;
+            }
+
+        } // namespace impl_details
+
+        /** \fn auto replay(std::vector<trace_record> const &trace, Engine engine, replay_options const &options = {}) -> replay_report
+            \brief Replays a trace against engine, called as engine(key_id, key, op, payload) for each record.
+                   Throws std::invalid_argument if options.speedup is not positive.
+
+            Each anonymized key id gets a generated key of its recorded size, and each call a message of its recorded
+            length; both are built before timing starts, so only the engine is measured. The engine may cache per-key
+            state (e.g. a prepared_key) by key_id.
+         */
+        template<typename Engine>
+        auto replay(std::vector<trace_record> const &trace, Engine engine, replay_options const &options = {}) -> replay_report
+        {
+            using clock = std::chrono::steady_clock;
+
+            if( !(options.speedup > 0.0) )
+            {
+                throw std::invalid_argument("The replay speedup must be positive.\n");
+            }
+
+            std::map<std::pair<std::uint64_t, std::int64_t>, hill_key> keys;
+            std::string symbols;
+
+            for( auto const &r : trace )
+            {
+                auto const id = std::make_pair(r.key_id, r.key_size);
+
+                if( keys.find(id) == keys.end() )
+                {
+                    keys.emplace(id, impl_details::replay_key(r.key_id, r.key_size));
+                }
+
+                symbols.resize(std::max<std::size_t>(symbols.size(), r.payload_length));
+            }
+
+            for( auto i = 0u; i < symbols.size(); ++i )
+            {
+                symbols[i] = impl_details::ch_table[(i * 31 + 7) % impl_details::ch_table.size()];
+            }
+
+            std::map<std::uint64_t, std::string> payloads;
+
+            for( auto const &r : trace )
+            {
+                if( payloads.find(r.payload_length) == payloads.end() )
+                {
+                    payloads.emplace(r.payload_length, symbols.substr(0, r.payload_length));
+                }
+            }
+
+            replay_report report;
+            std::vector<std::chrono::nanoseconds> latencies;
+            latencies.reserve(trace.size());
+
+            auto const start = clock::now();
+            auto scheduled = start;
+
+            for( auto const &r : trace )
+            {
+                if( options.recorded_speed )
+                {
+                    scheduled += std::chrono::duration_cast<clock::duration>(std::chrono::duration<double, std::nano>(static_cast<double>(r.gap.count()) / options.speedup));
+                    std::this_thread::sleep_until(scheduled);
+                }
+
+                auto const issued = options.recorded_speed ? scheduled : clock::now();
+
+                engine(r.key_id, keys.find(std::make_pair(r.key_id, r.key_size))->second, r.op, payloads.find(r.payload_length)->second);
+
+                latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - issued));
+                ++report.operations;
+                report.payload_bytes += r.payload_length;
+            }
+
+            report.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+
+            if( !latencies.empty() )
+            {
+                std::sort(latencies.begin(), latencies.end());
+
+                auto const percentile = [&](double q) { return latencies[static_cast<std::size_t>(q * static_cast<double>(latencies.size() - 1))]; };
+
+                std::chrono::nanoseconds total{ 0 };
+                for( auto latency : latencies )
+                {
+                    total += latency;
+                }
+
+                report.p50 = percentile(0.50);
+                report.p90 = percentile(0.90);
+                report.p99 = percentile(0.99);
+                report.max = latencies.back();
+                report.mean = total / static_cast<std::int64_t>(latencies.size());
+            }
+
+            return report;
+        }
+
+    } // namespace hill_cipher
+
+} // namespace math_nerd
+#endif // MATH_NERD_HILL_TRACE_H
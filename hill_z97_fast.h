@@ -0,0 +1,205 @@
+#pragma once
+#ifndef MATH_NERD_HILL_Z97_FAST_H
+#define MATH_NERD_HILL_Z97_FAST_H
+#include <array>
+#include <cstdint>
+#include <math_nerd/int_mod.h>
+
+/** \file hill_z97_fast.h
+    \brief A compact, branchless integer modulo 97 for the hot loops of the Hill Cipher.
+ */
+
+namespace math_nerd
+{
+    namespace hill_cipher
+    {
+        namespace impl_details
+        {
+            /** \fn constexpr auto make_inverse_table() -> std::array<std::uint8_t, 97>
+                \brief Multiplicative inverses modulo 97 (with 0 mapped to 0).
+             */
+            constexpr auto make_inverse_table() -> std::array<std::uint8_t, 97>
+            {
+                std::array<std::uint8_t, 97> table{};
+
+                for( std::uint32_t x = 1; x < 97; ++x )
+                {
+                    for( std::uint32_t y = 1; y < 97; ++y )
+                    {
+                        if( x * y % 97 == 1 )
+                        {
+                            table[x] = static_cast<std::uint8_t>(y);
+                        }
+                    }
+                }
+
+                return table;
+            }
+
+            /** \property inverse_table
+                \brief inverse_table[x] * x == 1 (mod 97) for x != 0.
+             */
+            constexpr std::array<std::uint8_t, 97> inverse_table = make_inverse_table();
+
+            /** \fn constexpr auto reduce_once(std::uint32_t x) -> std::uint32_t
+                \brief x mod 97 for x < 2 * 97, without a branch.
+             */
+            constexpr auto reduce_once(std::uint32_t x) -> std::uint32_t
+            {
+                return x - (97u & (0u - static_cast<std::uint32_t>(x >= 97)));
+            }
+
+            /** \fn constexpr auto barrett_reduce(std::uint32_t x) -> std::uint32_t
+                \brief x mod 97 for x < 97 * 97, by Barrett reduction.
+
+                675 / 2^16 underestimates 1 / 97 by less than 1 / 9409, so the quotient is at most one too small.
+             */
+            constexpr auto barrett_reduce(std::uint32_t x) -> std::uint32_t
+            {
+                auto const quotient = (x * 675u) >> 16;
+
+                return reduce_once(x - quotient * 97u);
+            }
+
+        } // namespace impl_details
+
+        /** \class z97_fast
+            \brief An integer modulo 97 stored in one byte, with branchless addition and subtraction, Barrett
+                   multiplication and table-based inverses.
+
+            Converts implicitly from int_mod<97> (and integers) and explicitly back, so it can stand in for z97
+            wherever values are loaded from and stored to a hill_key. Unlike z97, dividing by 0 gives 0; callers
+            are expected to check for a zero pivot first.
+         */
+        class z97_fast
+        {
+            public:
+                constexpr z97_fast() = default;
+
+                /** \fn constexpr z97_fast(std::int64_t v)
+                    \brief Reduces any integer modulo 97.
+                 */
+                constexpr z97_fast(std::int64_t v)
+                    : val{ static_cast<std::uint8_t>(v % 97 < 0 ? v % 97 + 97 : v % 97) }
+                {
+                }
+
+                /** \fn constexpr z97_fast(int_mod::int_mod<97> v)
+                    \brief Converts from z97.
+                 */
+                constexpr z97_fast(int_mod::int_mod<97> v)
+                    : val{ static_cast<std::uint8_t>(v.value()) }
+                {
+                }
+
+                /** \fn static constexpr auto from_reduced(std::uint32_t v) -> z97_fast
+                    \brief Wraps a value already in [0, 97), skipping the reduction.
+                 */
+                static constexpr auto from_reduced(std::uint32_t v) -> z97_fast
+                {
+                    z97_fast result;
+                    result.val = static_cast<std::uint8_t>(v);
+
+                    return result;
+                }
+
+                /** \fn explicit constexpr operator int_mod::int_mod<97>() const
+                    \brief Converts to z97.
+                 */
+                explicit constexpr operator int_mod::int_mod<97>() const
+                {
+                    return int_mod::int_mod<97>{ static_cast<std::int64_t>(val) };
+                }
+
+                /** \fn constexpr auto value() const -> std::uint32_t
+                    \brief Returns the representative in [0, 97).
+                 */
+                constexpr auto value() const -> std::uint32_t
+                {
+                    return val;
+                }
+
+                /** \fn constexpr auto inverse() const -> z97_fast
+                    \brief Returns the multiplicative inverse (0 for 0).
+                 */
+                constexpr auto inverse() const -> z97_fast
+                {
+                    return from_reduced(impl_details::inverse_table[val]);
+                }
+
+                constexpr auto operator-() const -> z97_fast
+                {
+                    return from_reduced(impl_details::reduce_once(97u - val));
+                }
+
+                constexpr auto operator+=(z97_fast other) -> z97_fast &
+                {
+                    val = static_cast<std::uint8_t>(impl_details::reduce_once(std::uint32_t{ val } + other.val));
+                    return *this;
+                }
+
+                constexpr auto operator-=(z97_fast other) -> z97_fast &
+                {
+                    val = static_cast<std::uint8_t>(impl_details::reduce_once(std::uint32_t{ val } + 97u - other.val));
+                    return *this;
+                }
+
+                constexpr auto operator*=(z97_fast other) -> z97_fast &
+                {
+                    val = static_cast<std::uint8_t>(impl_details::barrett_reduce(std::uint32_t{ val } * other.val));
+                    return *this;
+                }
+
+                constexpr auto operator/=(z97_fast other) -> z97_fast &
+                {
+                    return *this *= other.inverse();
+                }
+
+                /** \fn constexpr auto subtract_product(z97_fast a, z97_fast b) -> z97_fast &
+                    \brief *this -= a * b with a single reduction, the row operation of Gaussian elimination.
+                 */
+                constexpr auto subtract_product(z97_fast a, z97_fast b) -> z97_fast &
+                {
+                    // val + 96 * 97 - a * b lies in [0, 97 * 97).
+                    val = static_cast<std::uint8_t>(impl_details::barrett_reduce(std::uint32_t{ val } + 96u * 97u - std::uint32_t{ a.val } * b.val));
+                    return *this;
+                }
+
+                friend constexpr auto operator+(z97_fast a, z97_fast b) -> z97_fast
+                {
+                    return a += b;
+                }
+
+                friend constexpr auto operator-(z97_fast a, z97_fast b) -> z97_fast
+                {
+                    return a -= b;
+                }
+
+                friend constexpr auto operator*(z97_fast a, z97_fast b) -> z97_fast
+                {
+                    return a *= b;
+                }
+
+                friend constexpr auto operator/(z97_fast a, z97_fast b) -> z97_fast
+                {
+                    return a /= b;
+                }
+
+                friend constexpr auto operator==(z97_fast a, z97_fast b) -> bool
+                {
+                    return a.val == b.val;
+                }
+
+                friend constexpr auto operator!=(z97_fast a, z97_fast b) -> bool
+                {
+                    return a.val != b.val;
+                }
+
+            private:
+                std::uint8_t val{ 0 };
+        };
+
+    } // namespace hill_cipher
+
+} // namespace math_nerd
+#endif // MATH_NERD_HILL_Z97_FAST_H
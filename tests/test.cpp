@@ -1,10 +1,49 @@
 #include <math_nerd/hill_cipher.h>
+#include <math_nerd/hill_cipher_parallel.h>
+#include <math_nerd/hill_csv.h>
+#include <math_nerd/hill_key_loader.h>
+#include <math_nerd/hill_kronecker_key.h>
+#include <math_nerd/hill_lu_key.h>
+#include <math_nerd/hill_pipe_filter.h>
+#include <math_nerd/hill_pipeline.h>
+#include <math_nerd/hill_prepared_key.h>
+#include <math_nerd/hill_rounds.h>
+#include <math_nerd/hill_socket.h>
+#include <math_nerd/hill_trace.h>
+#include <math_nerd/hill_z97_fast.h>
 
 #define CATCH_DEFINE_MAIN
 #include "catch.hpp"
 
 namespace hc = math_nerd::hill_cipher;
 
+namespace
+{
+    // Deterministically builds an invertible key of the given size.
+    auto make_key(std::int64_t key_size, std::int64_t seed = 1) -> hc::hill_key
+    {
+        hc::hill_key key{ key_size };
+        std::uint64_t state = static_cast<std::uint64_t>(seed);
+
+        for( ;; )
+        {
+            for( auto i{ 0 }; i < key_size; ++i )
+            {
+                for( auto j{ 0 }; j < key_size; ++j )
+                {
+                    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+                    key[i][j] = static_cast<std::int64_t>((state >> 33) % 97);
+                }
+            }
+
+            if( hc::is_valid_key(key) )
+            {
+                return key;
+            }
+        }
+    }
+}
+
 TEST_CASE("Testing Matrix Key Inverse")
 {
     SECTION("Testing 2x2 Case")
@@ -80,6 +119,25 @@ TEST_CASE("Testing Matrix Key Inverse")
     }
 }
 
+TEST_CASE("Testing Non-Throwing Inversion")
+{
+    auto key{ make_key(9) };
+
+    auto inverse = hc::try_inverse(key);
+
+    REQUIRE(inverse.has_value());
+    REQUIRE(*inverse == key.inverse());
+
+    hc::hill_key singular{ 3 };
+    singular[0][0] = 1;
+    singular[1][1] = 1;
+    singular[2][0] = 4;
+
+    REQUIRE_FALSE(hc::try_inverse(singular).has_value());
+    REQUIRE_FALSE(hc::is_valid_key(singular));
+    REQUIRE(hc::is_valid_key(key));
+}
+
 TEST_CASE("Testing Character Table")
 {
     SECTION("z97 -> char")
@@ -202,3 +260,1083 @@ TEST_CASE("Testing Encryption and Decryption")
         REQUIRE(hc::decrypt(key, ct) == "R\tn3\trWpu\\\tFWt/}1zuTz\nBnayk^:S");
     }
 }
+
+TEST_CASE("Testing Parallel Encryption")
+{
+    SECTION("cgroup v2 parsing")
+    {
+        REQUIRE(hc::impl_details::parse_cpu_max("max 100000\n") == 0.0);
+        REQUIRE(hc::impl_details::parse_cpu_max("250000 100000\n") == 2.5);
+        REQUIRE(hc::impl_details::parse_cpu_list("0-3,8,10-11\n") == 7);
+
+        auto stats = hc::impl_details::parse_cpu_stat("usage_usec 10\nnr_periods 5\nnr_throttled 2\nthrottled_usec 300\n");
+        REQUIRE(stats.nr_periods == 5);
+        REQUIRE(stats.nr_throttled == 2);
+        REQUIRE(stats.throttled_usec == 300);
+    }
+
+    SECTION("Effective parallelism")
+    {
+        hc::cpu_limits limits;
+        limits.hardware_threads = 64;
+        limits.cpuset_cpus = 8;
+        limits.quota_cpus = 2.5;
+
+        REQUIRE(hc::effective_parallelism(limits) == 3);
+
+        limits.quota_cpus = 0.0;
+        REQUIRE(hc::effective_parallelism(limits) == 8);
+    }
+
+    SECTION("Matches serial encryption")
+    {
+        constexpr std::int64_t key_size = 5;
+        hc::hill_key key{ key_size };
+
+        for( auto i{ 0u }; i < key_size; ++i )
+        {
+            for( auto j{ 0u }; j < key_size; ++j )
+            {
+                if( i < j )
+                {
+                    key[i][j] = 5ULL * i - 2 * j;
+                }
+                else
+                {
+                    key[i][j] = 3ULL * i + j;
+                }
+            }
+        }
+
+        hc::thread_pool pool{ 4 };
+        std::string pt;
+
+        for( auto i{ 0u }; i < 1000; ++i )
+        {
+            pt += "Hello, world! ";
+        }
+
+        auto ct = hc::parallel_encrypt(pool, key, pt);
+
+        REQUIRE(ct == hc::encrypt(key, pt));
+        REQUIRE(hc::parallel_decrypt(pool, key, ct) == hc::decrypt(key, ct));
+        REQUIRE(pool.stats().threads == 4);
+    }
+}
+
+TEST_CASE("Testing Prepared Keys")
+{
+    SECTION("Matches encrypt/decrypt for every padding length")
+    {
+        auto key{ make_key(16) };
+        hc::prepared_key prepared{ key };
+
+        std::string pt = "Short messages are mostly padding for a large key.";
+
+        for( auto length{ 0u }; length <= pt.length(); ++length )
+        {
+            auto msg = pt.substr(0, length);
+
+            REQUIRE(prepared.encrypt(msg) == hc::encrypt(key, msg));
+            REQUIRE(prepared.decrypt(msg) == hc::decrypt(key, msg));
+        }
+    }
+
+    SECTION("Round trip")
+    {
+        hc::prepared_key prepared{ make_key(20) };
+        std::string pt = "Hi!";
+
+        auto ct = prepared.encrypt(pt);
+
+        REQUIRE(ct.length() == 20);
+        REQUIRE(prepared.decrypt(ct).substr(0, 3) == pt);
+    }
+
+    SECTION("Singular key")
+    {
+        hc::hill_key key{ 3 };
+        REQUIRE_THROWS_AS(hc::prepared_key{ key }, std::invalid_argument);
+    }
+
+    SECTION("Rank-k updates keep the inverse in sync")
+    {
+        auto key{ make_key(10) };
+        hc::prepared_key prepared{ key };
+
+        hc::msg_block u(10), v(10);
+        for( auto i{ 0 }; i < 10; ++i )
+        {
+            u[i] = 3 * i + 1;
+            v[i] = 7 * i + 2;
+        }
+
+        hc::hill_key identity{ 10 };
+        for( auto i{ 0 }; i < 10; ++i )
+        {
+            identity[i][i] = 1;
+        }
+
+        prepared.update({ u }, { v });
+
+        for( auto i{ 0 }; i < 10; ++i )
+        {
+            for( auto j{ 0 }; j < 10; ++j )
+            {
+                key[i][j] += u[i] * v[j];
+            }
+        }
+
+        REQUIRE(prepared.key() == key);
+        REQUIRE(prepared.key() * prepared.inverse() == identity);
+
+        auto replacement{ make_key(10, 77) };
+        prepared.replace_rows({ 2, 5, 9 }, { hc::msg_block(replacement[2]), hc::msg_block(replacement[5]), hc::msg_block(replacement[9]) });
+
+        key[2] = replacement[2];
+        key[5] = replacement[5];
+        key[9] = replacement[9];
+
+        REQUIRE(prepared.key() == key);
+        REQUIRE(prepared.key() * prepared.inverse() == identity);
+        REQUIRE(prepared.decrypt(prepared.encrypt("Epoch 2")).substr(0, 7) == "Epoch 2");
+    }
+
+    SECTION("Singular updates are rejected")
+    {
+        auto key{ make_key(6) };
+        hc::prepared_key prepared{ key };
+
+        // Making row 0 equal to row 1 makes the key singular.
+        REQUIRE_THROWS_AS(prepared.replace_rows({ 0 }, { hc::msg_block(key[1]) }), std::invalid_argument);
+        REQUIRE(prepared.key() == key);
+    }
+
+    SECTION("Structure detection")
+    {
+        constexpr std::int64_t key_size = 8;
+
+        auto check = [](hc::hill_key const &key, hc::key_structure expected)
+        {
+            hc::prepared_key prepared{ key };
+
+            std::string pt = "Structured keys take shortcuts.";
+
+            REQUIRE(prepared.stats().encrypt.structure == expected);
+            REQUIRE(prepared.inverse() == key.inverse());
+            REQUIRE(prepared.encrypt(pt) == hc::encrypt(key, pt));
+            REQUIRE(prepared.decrypt(pt) == hc::decrypt(key, pt));
+        };
+
+        auto dense{ make_key(key_size) };
+        hc::hill_key diagonal{ key_size }, permutation{ key_size }, upper{ key_size }, lower{ key_size };
+
+        // Block diagonal and sparse keys are products of unit lower and unit upper triangular factors,
+        // so they are invertible by construction.
+        hc::hill_key block_lower{ key_size }, block_upper{ key_size }, sparse_lower{ key_size }, sparse_upper{ key_size };
+
+        for( auto i{ 0 }; i < key_size; ++i )
+        {
+            diagonal[i][i] = i + 1;
+            permutation[i][(3 * i + 1) % key_size] = 2 * i + 5;
+            block_lower[i][i] = block_upper[i][i] = sparse_lower[i][i] = sparse_upper[i][i] = 1;
+
+            if( i + 3 < key_size )
+            {
+                sparse_upper[i][i + 3] = i + 2;
+            }
+
+            for( auto j{ 0 }; j < key_size; ++j )
+            {
+                if( j >= i )
+                {
+                    upper[i][j] = dense[i][j] + (i == j ? 1 : 0);
+                    lower[j][i] = dense[i][j] + (i == j ? 1 : 0);
+                }
+
+                // Blocks of sizes 3 and 5.
+                if( (i < 3) == (j < 3) && j < i )
+                {
+                    block_lower[i][j] = i + j + 1;
+                    block_upper[j][i] = 2 * j + i + 1;
+                }
+            }
+
+            if( upper[i][i] == 0 )
+            {
+                upper[i][i] = lower[i][i] = 1;
+            }
+        }
+
+        // One entry below the diagonal joins the rows into a single block.
+        sparse_lower[key_size - 1][0] = 5;
+
+        auto const blocks{ block_lower * block_upper };
+        auto const sparse{ sparse_lower * sparse_upper };
+
+        check(dense, hc::key_structure::dense);
+        check(diagonal, hc::key_structure::diagonal);
+        check(permutation, hc::key_structure::permutation);
+        check(upper, hc::key_structure::upper_triangular);
+        check(lower, hc::key_structure::lower_triangular);
+
+        check(blocks, hc::key_structure::block_diagonal);
+        REQUIRE(hc::prepared_key{ blocks }.stats().encrypt.blocks == std::vector<std::int64_t>{ 3, 5 });
+        check(sparse, hc::key_structure::sparse);
+
+        REQUIRE(hc::to_string(hc::key_structure::block_diagonal) == "block diagonal");
+    }
+
+    SECTION("Singular structured keys")
+    {
+        hc::hill_key diagonal{ 4 }, upper{ 4 };
+
+        diagonal[0][0] = diagonal[1][1] = diagonal[3][3] = 1;
+        upper[0][0] = upper[1][1] = upper[2][2] = 1;
+        upper[0][3] = 5;
+
+        REQUIRE_THROWS_AS(hc::prepared_key{ diagonal }, std::invalid_argument);
+        REQUIRE_THROWS_AS(hc::prepared_key{ upper }, std::invalid_argument);
+    }
+
+    SECTION("Lazy inversion")
+    {
+        auto key{ make_key(12) };
+        hc::prepared_key prepared{ key, hc::inversion::lazy };
+
+        std::string pt = "Encrypt-only users never invert.";
+        auto ct = prepared.encrypt(pt);
+
+        REQUIRE(ct == hc::encrypt(key, pt));
+        REQUIRE(!prepared.stats().inverse_ready);
+
+        REQUIRE(prepared.decrypt(ct) == hc::decrypt(key, ct));
+        REQUIRE(prepared.stats().inverse_ready);
+        REQUIRE(prepared.stats().inverse_waits == 1);
+
+        prepared.decrypt(ct);
+        REQUIRE(prepared.stats().inverse_waits == 1);
+    }
+
+    SECTION("Concurrent first decrypts compute the inverse once")
+    {
+        auto key{ make_key(24) };
+        hc::prepared_key prepared{ key, hc::inversion::lazy };
+
+        auto ct = hc::encrypt(key, "Many threads, one inversion.");
+        std::vector<std::string> results(8);
+        std::vector<std::thread> threads;
+
+        for( auto i{ 0u }; i < results.size(); ++i )
+        {
+            threads.emplace_back([&, i] { results[i] = prepared.decrypt(ct); });
+        }
+
+        for( auto &thread : threads )
+        {
+            thread.join();
+        }
+
+        for( auto const &result : results )
+        {
+            REQUIRE(result == hc::decrypt(key, ct));
+        }
+
+        REQUIRE(prepared.inverse() == key.inverse());
+    }
+
+    SECTION("Background inversion")
+    {
+        auto key{ make_key(16) };
+        hc::prepared_key prepared{ key, hc::inversion::background };
+
+        std::string pt = "Ready when needed.";
+
+        REQUIRE(prepared.decrypt(prepared.encrypt(pt)).substr(0, pt.length()) == pt);
+        REQUIRE(prepared.stats().inverse_ready);
+        REQUIRE(prepared.stats().time_to_inverse >= prepared.stats().inverse_compute_time);
+    }
+
+    SECTION("Background keys share one worker and are not waited for")
+    {
+        std::string pt = "Dropped before their turn.";
+
+        for( auto i{ 0 }; i < 64; ++i )
+        {
+            hc::prepared_key dropped{ make_key(48, i + 1), hc::inversion::background };
+            REQUIRE(dropped.encrypt(pt) == hc::encrypt(make_key(48, i + 1), pt));
+        }
+
+        auto key{ make_key(16) };
+        hc::prepared_key kept{ key, hc::inversion::background };
+
+        REQUIRE(kept.inverse() == key.inverse());
+    }
+
+    SECTION("Foreground decrypts do not wait on the background worker")
+    {
+        auto key{ make_key(256) };
+        hc::prepared_key prepared{ key, hc::inversion::background };
+
+        // Let the idle-priority worker start on the inverse, then starve it with a busy thread per core.
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+
+        std::atomic<bool> stop{ false };
+        std::vector<std::thread> load;
+
+        for( auto i{ 0u }; i < std::max(1u, std::thread::hardware_concurrency()); ++i )
+        {
+            load.emplace_back([&] { while( !stop.load(std::memory_order_relaxed) ) {} });
+        }
+
+        auto ct = hc::encrypt(key, "Not behind an idle thread.");
+        auto const start = std::chrono::steady_clock::now();
+        auto const pt = prepared.decrypt(ct);
+        auto const elapsed = std::chrono::steady_clock::now() - start;
+
+        stop = true;
+
+        for( auto &thread : load )
+        {
+            thread.join();
+        }
+
+        REQUIRE(pt == hc::decrypt(key, ct));
+        REQUIRE(elapsed < std::chrono::seconds(5));
+    }
+
+    SECTION("Copies and moves keep the inverse")
+    {
+        auto key{ make_key(10) };
+        hc::prepared_key original{ key, hc::inversion::lazy };
+        auto ct = hc::encrypt(key, "Value semantics.");
+
+        hc::prepared_key copy = original;
+        REQUIRE(copy.decrypt(ct) == hc::decrypt(key, ct));
+        REQUIRE(original.stats().inverse_ready);
+
+        hc::prepared_key moved = std::move(original);
+        REQUIRE(moved.decrypt(ct) == hc::decrypt(key, ct));
+        REQUIRE(moved.inverse() == key.inverse());
+
+        // A moved-from key can be assigned to again.
+        original = copy;
+        REQUIRE(original.encrypt("Value semantics.") == hc::encrypt(key, "Value semantics."));
+        REQUIRE(original.decrypt(ct) == hc::decrypt(key, ct));
+
+        // Doubling a row keeps the key invertible; the update must not reach the keys the state was shared with.
+        hc::msg_block doubled(10);
+        for( auto j{ 0 }; j < 10; ++j )
+        {
+            doubled[j] = key[0][j] * hc::z97{ 2 };
+        }
+
+        copy.replace_rows({ 0 }, { doubled });
+        REQUIRE(copy.inverse() == copy.key().inverse());
+        REQUIRE(moved.inverse() == key.inverse());
+    }
+
+    SECTION("Lazy inversion of a singular key")
+    {
+        hc::hill_key key{ 3 };
+        key[0][0] = 1;
+
+        for( auto when : { hc::inversion::lazy, hc::inversion::background } )
+        {
+            hc::prepared_key prepared{ key, when };
+
+            REQUIRE(prepared.encrypt("abc") == hc::encrypt(key, "abc"));
+            REQUIRE_THROWS_AS(prepared.decrypt("abc"), std::invalid_argument);
+            REQUIRE_THROWS_AS(prepared.inverse(), std::invalid_argument);
+            REQUIRE(!prepared.stats().inverse_ready);
+        }
+    }
+}
+
+TEST_CASE("Testing Pipelines")
+{
+    auto key{ make_key(7) };
+
+    std::string pt;
+
+    for( auto i{ 0u }; i < 500; ++i )
+    {
+        pt += "The quick brown fox jumps over the lazy dog. ";
+    }
+
+    SECTION("Translate, multiply, pack matches encrypt")
+    {
+        auto pipe = hc::pipeline_builder{}.translate().multiply(key).pack().tile_size(64).build();
+
+        REQUIRE(pipe.block_size() == 7);
+        REQUIRE(pipe.run(pt).output == hc::encrypt(key, pt));
+    }
+
+    SECTION("Offsets and checksum do not depend on the tile size")
+    {
+        hc::msg_block tweak{ 3, 1, 4, 1, 5 };
+
+        auto small = hc::pipeline_builder{}.translate().multiply(key).offset(tweak).checksum().pack().tile_size(7).build().run(pt);
+        auto large = hc::pipeline_builder{}.translate().multiply(key).offset(tweak).checksum().pack().build().run(pt);
+
+        REQUIRE(small.output == large.output);
+        REQUIRE(small.checksum == large.checksum);
+
+        // Undo the offsets, then the multiply.
+        hc::msg_block untweak;
+        for( auto t : tweak )
+        {
+            untweak.push_back(-t);
+        }
+
+        auto back = hc::pipeline_builder{}.translate().offset(untweak).multiply(key.inverse()).pack().build().run(large.output);
+        REQUIRE(back.output.substr(0, pt.length()) == pt);
+    }
+
+    SECTION("Mismatched key sizes")
+    {
+        hc::pipeline_builder builder;
+        builder.multiply(key);
+
+        REQUIRE_THROWS_AS(builder.multiply(make_key(3)), std::invalid_argument);
+    }
+}
+
+TEST_CASE("Testing Multi-Round Cipher")
+{
+    SECTION("S-box is a permutation")
+    {
+        for( auto x{ 0u }; x < 97; ++x )
+        {
+            REQUIRE(hc::impl_details::inv_sbox[hc::impl_details::sbox[x]] == x);
+        }
+    }
+
+    SECTION("Vectorized substitution matches the table")
+    {
+        // 97 residues plus a tail shorter than one 16-symbol lookup.
+        std::vector<std::uint8_t> data(97 + 7);
+        for( auto i{ 0u }; i < data.size(); ++i )
+        {
+            data[i] = static_cast<std::uint8_t>(i % 97);
+        }
+
+        hc::impl_details::substitute(hc::impl_details::sbox_pieces, data.data(), data.size());
+
+        for( auto i{ 0u }; i < data.size(); ++i )
+        {
+            REQUIRE(data[i] == hc::impl_details::sbox[i % 97]);
+        }
+    }
+
+    SECTION("Round trip with blocks wider than one lookup")
+    {
+        auto cipher = hc::round_cipher::generate(40, 3, 7);
+        std::string pt = "Forty symbols per block take two pshufb lookups and a scalar tail.";
+
+        REQUIRE(cipher.decrypt(cipher.encrypt(pt)).substr(0, pt.length()) == pt);
+    }
+
+    SECTION("Round trip")
+    {
+        auto cipher = hc::round_cipher::generate(8, 4, 2024);
+        std::string pt = "Known plaintext no longer gives a linear system.";
+
+        auto ct = cipher.encrypt(pt);
+
+        REQUIRE(cipher.rounds() == 4);
+        REQUIRE(ct != hc::encrypt(make_key(8), pt));
+        REQUIRE(cipher.decrypt(ct).substr(0, pt.length()) == pt);
+    }
+
+    SECTION("Invalid rounds")
+    {
+        std::vector<hc::hill_key> keys{ make_key(3) };
+
+        REQUIRE_THROWS_AS((hc::round_cipher{ keys, { { 0, 1, 1 } } }), std::invalid_argument);
+        REQUIRE_THROWS_AS((hc::round_cipher{ keys, { { 0, 1 } } }), std::invalid_argument);
+        REQUIRE_THROWS_AS((hc::round_cipher{ { hc::hill_key{ 3 } }, { { 0, 1, 2 } } }), std::invalid_argument);
+    }
+}
+
+TEST_CASE("Testing LU-Factored Keys")
+{
+    SECTION("Factoring a dense key")
+    {
+        auto key{ make_key(12) };
+        hc::lu_key factored{ key };
+
+        std::string pt = "Two triangular solves instead of an inverse.";
+
+        REQUIRE(factored.to_key() == key);
+        REQUIRE(factored.encrypt(pt) == hc::encrypt(key, pt));
+        REQUIRE(factored.decrypt(pt) == hc::decrypt(key, pt));
+    }
+
+    SECTION("Key with a zero leading entry needs pivoting")
+    {
+        // key = P * L * U with P swapping the first two rows and L[1][0] == 0, so key[0][0] == 0 yet det(key) == -1.
+        hc::hill_key swap{ 4 }, lower{ 4 }, upper{ 4 };
+
+        for( auto i{ 0 }; i < 4; ++i )
+        {
+            swap[i][i < 2 ? 1 - i : i] = 1;
+
+            for( auto j{ 0 }; j < 4; ++j )
+            {
+                lower[i][j] = (j < i && i != 1) ? i + j : (i == j ? 1 : 0);
+                upper[i][j] = j > i ? 2 * i + j + 1 : (i == j ? 1 : 0);
+            }
+        }
+
+        auto const key{ swap * lower * upper };
+
+        REQUIRE(key[0][0] == 0);
+        REQUIRE(hc::lu_key{ key }.to_key() == key);
+        REQUIRE(hc::lu_key{ key }.encrypt("Pivot!") == hc::encrypt(key, "Pivot!"));
+    }
+
+    SECTION("Generated keys")
+    {
+        auto factored = hc::lu_key::generate(24, 99);
+        auto key = factored.to_key();
+
+        std::string pt = "Generated directly as P * L * U.";
+        auto ct = factored.encrypt(pt);
+
+        REQUIRE(hc::is_valid_key(key));
+        REQUIRE(ct == hc::encrypt(key, pt));
+        REQUIRE(factored.decrypt(ct).substr(0, pt.length()) == pt);
+    }
+
+    SECTION("Singular key")
+    {
+        hc::hill_key key{ 3 };
+        REQUIRE_THROWS_AS(hc::lu_key{ key }, std::invalid_argument);
+    }
+}
+
+TEST_CASE("Testing Kronecker Keys")
+{
+    SECTION("Single term matches the dense Kronecker product")
+    {
+        auto a{ make_key(3) };
+        auto b{ make_key(4, 5) };
+        hc::kronecker_key key{ a, b };
+
+        auto dense = key.to_key();
+
+        for( auto i{ 0 }; i < 12; ++i )
+        {
+            for( auto j{ 0 }; j < 12; ++j )
+            {
+                REQUIRE(dense[i][j] == a[i / 4][j / 4] * b[i % 4][j % 4]);
+            }
+        }
+
+        std::string pt = "Reshape, multiply, reshape.";
+
+        REQUIRE(key.encrypt(pt) == hc::encrypt(dense, pt));
+        REQUIRE(key.decrypt(pt) == hc::decrypt(dense, pt));
+    }
+
+    SECTION("Chained terms with different splits")
+    {
+        hc::kronecker_key key{ { { make_key(2), make_key(6, 2) }, { make_key(3, 3), make_key(4, 4) } } };
+
+        auto dense = key.to_key();
+        hc::hill_key identity{ 12 };
+
+        for( auto i{ 0 }; i < 12; ++i )
+        {
+            identity[i][i] = 1;
+        }
+
+        REQUIRE(dense * key.inverse().to_key() == identity);
+
+        std::string pt = "A chain of Kronecker products.";
+        auto ct = key.encrypt(pt);
+
+        REQUIRE(ct == hc::encrypt(dense, pt));
+        REQUIRE(key.decrypt(ct).substr(0, pt.length()) == pt);
+    }
+
+    SECTION("Generated keys")
+    {
+        auto key = hc::kronecker_key::generate(8, 8, 2, 11);
+        std::string pt = "Sixty-four symbols per block from two eight by eight factors.";
+
+        REQUIRE(key.size() == 64);
+        REQUIRE(key.decrypt(key.encrypt(pt)).substr(0, pt.length()) == pt);
+    }
+
+    SECTION("Invalid terms")
+    {
+        REQUIRE_THROWS_AS((hc::kronecker_key{ make_key(2), hc::hill_key{ 3 } }), std::invalid_argument);
+        REQUIRE_THROWS_AS((hc::kronecker_key{ { { make_key(2), make_key(3) }, { make_key(2), make_key(2) } } }), std::invalid_argument);
+    }
+}
+
+TEST_CASE("Testing Pipe Filter")
+{
+    auto key{ make_key(9) };
+
+    std::string pt;
+
+    for( auto i{ 0u }; i < 20000; ++i )
+    {
+        pt += "Streaming through a shell pipeline. ";
+    }
+
+    pt += "Tail";
+
+    // Runs pipe_filter between two pipes, feeding in and collecting the output on other threads. With relay, the
+    // output is first spliced into a large second pipe and read from there slowly, so the filter's pages are still
+    // referenced long after they have left the output pipe.
+    auto run = [&](std::string const &in, hc::filter_mode mode, bool relay = false)
+    {
+        int input[2], output[2], relayed[2];
+        REQUIRE(pipe(input) == 0);
+        REQUIRE(pipe(output) == 0);
+        REQUIRE(pipe(relayed) == 0);
+        fcntl(relayed[1], F_SETPIPE_SZ, 1 << 20);
+
+        std::thread forwarder{ [&]
+        {
+            while( relay && splice(output[0], nullptr, relayed[1], nullptr, 1 << 16, 0) > 0 )
+            {
+            }
+            close(relayed[1]);
+        } };
+
+        std::thread writer{ [&]
+        {
+            for( std::size_t done = 0; done < in.size(); )
+            {
+                auto const n = write(input[1], in.data() + done, in.size() - done);
+                if( n <= 0 )
+                {
+                    break;
+                }
+                done += static_cast<std::size_t>(n);
+            }
+            close(input[1]);
+        } };
+
+        std::string out;
+        std::thread reader{ [&]
+        {
+            char buffer[4096];
+            for( ;; )
+            {
+                auto const n = read(relay ? relayed[0] : output[0], buffer, sizeof(buffer));
+                if( n <= 0 )
+                {
+                    break;
+                }
+                out.append(buffer, static_cast<std::size_t>(n));
+
+                if( relay )
+                {
+                    std::this_thread::sleep_for(std::chrono::microseconds{ 200 });
+                }
+            }
+        } };
+
+        auto stats = hc::pipe_filter(key, input[0], output[1], mode);
+        close(output[1]);
+
+        writer.join();
+        forwarder.join();
+        reader.join();
+        close(input[0]);
+        close(output[0]);
+        close(relayed[0]);
+
+        REQUIRE(stats.bytes_in == in.size());
+        REQUIRE(stats.bytes_out == out.size());
+        REQUIRE(stats.write_calls == 0); // Pipe output goes through vmsplice.
+
+        return out;
+    };
+
+    SECTION("Matches encrypt/decrypt")
+    {
+        auto ct = run(pt, hc::filter_mode::encrypt);
+
+        REQUIRE(ct == hc::encrypt(key, pt));
+        REQUIRE(run(ct, hc::filter_mode::decrypt) == hc::decrypt(key, ct));
+    }
+
+    SECTION("Empty input")
+    {
+        REQUIRE(run("", hc::filter_mode::encrypt).empty());
+    }
+
+    SECTION("Output spliced onward by the consumer")
+    {
+        REQUIRE(run(pt, hc::filter_mode::encrypt, true) == hc::encrypt(key, pt));
+    }
+}
+
+TEST_CASE("Testing CSV Field Encryption")
+{
+    auto key{ make_key(4) };
+
+    std::string csv = "id,name,email,notes\n"
+                      "1,Ada,ada@example.com,\"likes, commas\"\n"
+                      "2,\"Grace \"\"Amazing\"\" Hopper\",grace@example.com,\"multi\nline\"\r\n"
+                      "3,,x@y.z,last";
+
+    hc::csv_options options;
+    options.columns = { 1, 2 };
+
+    SECTION("SIMD separator scan is quote-aware")
+    {
+        std::vector<std::uint32_t> positions;
+        std::string line = "a,\"b,c\",\"d\"\"e\"\nf";
+
+        hc::impl_details::find_separators(line.data(), line.size(), ',', '"', positions);
+
+        REQUIRE(positions == std::vector<std::uint32_t>{ 1, 7, 14 });
+    }
+
+    SECTION("Selected fields are encrypted, everything else is copied")
+    {
+        for( std::size_t chunk : { 7u, 64u, 1u << 20 } )
+        {
+            options.chunk_size = chunk;
+
+            std::istringstream in{ csv };
+            std::ostringstream out;
+
+            auto stats = hc::csv_transform(key, in, out, options);
+
+            // Ciphertext may contain quotes, which are doubled inside the quoted field.
+            auto quote = [&](std::string const &pt)
+            {
+                std::string field = "\"";
+                for( auto c : hc::encrypt(key, pt) )
+                {
+                    field += (c == '"') ? "\"\"" : std::string(1, c);
+                }
+                return field + "\"";
+            };
+
+            REQUIRE(out.str() == "id,name,email,notes\n"
+                                 "1," + quote("Ada") + "," + quote("ada@example.com") + ",\"likes, commas\"\n"
+                                 "2," + quote("Grace \"Amazing\" Hopper") + "," + quote("grace@example.com") + ",\"multi\nline\"\r\n"
+                                 "3," + quote("") + "," + quote("x@y.z") + ",last");
+
+            REQUIRE(stats.records == 4);
+            REQUIRE(stats.fields_transformed == 6);
+            REQUIRE(stats.bytes_in == csv.size());
+
+            options.mode = hc::filter_mode::decrypt;
+
+            std::istringstream back_in{ out.str() };
+            std::ostringstream back_out;
+            hc::csv_transform(key, back_in, back_out, options);
+
+            options.mode = hc::filter_mode::encrypt;
+
+            REQUIRE(back_out.str() == "id,name,email,notes\n"
+                                      "1,\"Ada \",\"ada@example.com \",\"likes, commas\"\n"
+                                      "2,\"Grace \"\"Amazing\"\" Hopper  \",\"grace@example.com   \",\"multi\nline\"\r\n"
+                                      "3,\"\",\"x@y.z   \",last");
+        }
+    }
+
+}
+
+TEST_CASE("Testing Bulk Key Loading")
+{
+    auto dense{ make_key(5) };
+
+    std::string file = "# id size entries...\n"
+                       "identity 2 1 0 0 1\n"
+                       "\n"
+                       "singular 2 1 2 2 4\n"
+                       "short 3 1 2 3\r\n"
+                       "bad-size x 1\n"
+                       "dense 5";
+
+    for( auto i{ 0 }; i < 5; ++i )
+    {
+        for( auto j{ 0 }; j < 5; ++j )
+        {
+            file += " " + std::to_string(dense[i][j].value());
+        }
+    }
+
+    hc::thread_pool pool{ 3 };
+    auto report = hc::load_keys_from_string(file, pool);
+
+    REQUIRE(report.keys.size() == 2);
+    REQUIRE(report.keys[0].id == "identity");
+    REQUIRE(report.keys[1].id == "dense");
+    REQUIRE(report.keys[1].key == dense);
+    REQUIRE(report.keys[1].inverse == dense.inverse());
+
+    REQUIRE(report.rejected.size() == 3);
+    REQUIRE(report.rejected[0].line == 4);
+    REQUIRE(report.rejected[0].reason == "key is not invertible");
+    REQUIRE(report.rejected[1].reason == "missing or invalid entry");
+    REQUIRE(report.rejected[2].reason == "invalid key size");
+
+    REQUIRE_THROWS_AS(hc::load_keys("/nonexistent/keys.txt", pool), std::runtime_error);
+}
+
+TEST_CASE("Testing Fast Arithmetic")
+{
+    SECTION("Agrees with z97 on every pair")
+    {
+        for( auto x{ 0 }; x < 97; ++x )
+        {
+            hc::z97 const a{ x };
+            hc::z97_fast const fa{ a };
+
+            REQUIRE(static_cast<hc::z97>(fa) == a);
+            REQUIRE(static_cast<hc::z97>(-fa) == -a);
+
+            for( auto y{ 0 }; y < 97; ++y )
+            {
+                hc::z97 const b{ y };
+                hc::z97_fast const fb{ b };
+
+                REQUIRE(static_cast<hc::z97>(fa + fb) == a + b);
+                REQUIRE(static_cast<hc::z97>(fa - fb) == a - b);
+                REQUIRE(static_cast<hc::z97>(fa * fb) == a * b);
+                REQUIRE(static_cast<hc::z97>(hc::z97_fast{ fb }.subtract_product(fa, fb)) == b - a * b);
+
+                if( y != 0 )
+                {
+                    REQUIRE(static_cast<hc::z97>(fa / fb) == a / b);
+                }
+            }
+        }
+    }
+
+    SECTION("Conversions and inverses")
+    {
+        REQUIRE(hc::z97_fast{ -1 }.value() == 96);
+        REQUIRE(hc::z97_fast{ 97 * 5 + 3 }.value() == 3);
+        REQUIRE(hc::z97_fast{ 0 }.inverse() == 0);
+        REQUIRE(hc::z97_fast{ 41 } * hc::z97_fast{ 41 }.inverse() == 1);
+        REQUIRE(hc::z97{ 5 } + hc::z97_fast{ 95 } == 3);
+    }
+
+}
+
+TEST_CASE("Testing Encrypted Sockets")
+{
+    auto key{ make_key(7) };
+
+    hc::socket_options options;
+    options.max_frame = 100;
+    options.max_queued_frames = 4;
+
+    SECTION("Round trip over a Unix socket pair")
+    {
+        int fds[2];
+        REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+        hc::encrypted_socket a{ fds[0], key, options }, b{ fds[1], key, options };
+
+        std::vector<std::string> messages{ "Hi!", "Exactly 7", std::string(250, 'x'), "The quick brown fox jumps over the lazy dog." };
+        std::string expected;
+
+        std::thread sender{ [&]
+        {
+            for( auto const &message : messages )
+            {
+                a.send(message);
+            }
+
+            a.shutdown_send();
+        } };
+
+        std::string received;
+        std::size_t frames = 0;
+
+        while( auto payload = b.receive() )
+        {
+            REQUIRE(payload->length() <= 98);
+            received += *payload;
+            ++frames;
+        }
+
+        sender.join();
+
+        for( auto const &message : messages )
+        {
+            expected += message;
+        }
+
+        // max_frame is rounded down to a whole number of blocks (98), so the long message takes three frames.
+        REQUIRE(received == expected);
+        REQUIRE(frames == 6);
+        REQUIRE(a.stats().frames_sent == 6);
+        REQUIRE(a.stats().payload_bytes_sent == expected.size());
+        REQUIRE(b.stats().frames_received == 6);
+    }
+
+    SECTION("Wire format")
+    {
+        int fds[2];
+        REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+        std::string pt = "Hello, world!";
+
+        {
+            hc::encrypted_socket a{ fds[0], key, options };
+            a.send(pt);
+        }
+
+        std::string wire(64, '\0');
+        auto const got = read(fds[1], wire.data(), wire.size());
+        close(fds[1]);
+
+        REQUIRE(got == 4 + 14);
+        REQUIRE(wire.substr(0, 4) == std::string("\x0d\0\0\0", 4));
+        REQUIRE(wire.substr(4, 14) == hc::encrypt(key, pt));
+    }
+
+    SECTION("Truncated frames are reported")
+    {
+        int fds[2];
+        REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+        hc::encrypted_socket b{ fds[1], key, options };
+
+        REQUIRE(write(fds[0], "\x05\0\0\0abc", 7) == 7);
+        close(fds[0]);
+
+        REQUIRE_THROWS_AS(b.receive(), std::runtime_error);
+    }
+
+    SECTION("A singular key still closes the socket")
+    {
+        int fds[2];
+        REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+        hc::hill_key singular{ 7 };
+        singular[0][0] = 1;
+
+        REQUIRE_THROWS_AS((hc::encrypted_socket{ fds[0], singular, options }), std::invalid_argument);
+        REQUIRE(fcntl(fds[0], F_GETFD) == -1);
+
+        close(fds[1]);
+    }
+}
+
+TEST_CASE("Testing Trace Record and Replay")
+{
+    hc::trace_recorder recorder{ { 1234, 5678 } };
+
+    recorder.record("tenant-a/key-1", 4, 100, hc::filter_mode::encrypt);
+    recorder.record("tenant-b/key-7", 9, 5, hc::filter_mode::decrypt);
+    recorder.record("tenant-a/key-1", 4, 0, hc::filter_mode::decrypt);
+
+    auto trace = recorder.trace();
+
+    SECTION("Recording anonymizes key ids")
+    {
+        REQUIRE(trace.size() == 3);
+        REQUIRE(trace[0].key_id == trace[2].key_id);
+        REQUIRE(trace[0].key_id != trace[1].key_id);
+        REQUIRE(trace[0].key_id == recorder.anonymize("tenant-a/key-1"));
+        REQUIRE(hc::trace_recorder{ { 99, 5678 } }.anonymize("tenant-a/key-1") != trace[0].key_id);
+        REQUIRE(trace[1].key_size == 9);
+        REQUIRE(trace[1].payload_length == 5);
+        REQUIRE(trace[1].op == hc::filter_mode::decrypt);
+    }
+
+    SECTION("Key ids are hashed with SipHash-2-4")
+    {
+        // Reference vectors from the SipHash paper: key 00 01 ... 0f, messages 00 01 ... (n - 1).
+        hc::trace_secret const secret{ 0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL };
+        std::string message;
+
+        REQUIRE(hc::impl_details::siphash(secret, message) == 0x726fdb47dd0e0e31ULL);
+
+        for( auto i{ 0 }; i < 15; ++i )
+        {
+            message += static_cast<char>(i);
+        }
+
+        REQUIRE(hc::impl_details::siphash(secret, message) == 0xa129ca6149be45e5ULL);
+    }
+
+    SECTION("Trace files round trip")
+    {
+        std::stringstream file;
+        hc::write_trace(file, trace);
+
+        auto read = hc::read_trace(file);
+
+        REQUIRE(read.size() == trace.size());
+
+        for( auto i{ 0u }; i < read.size(); ++i )
+        {
+            REQUIRE(read[i].gap == trace[i].gap);
+            REQUIRE(read[i].key_id == trace[i].key_id);
+            REQUIRE(read[i].key_size == trace[i].key_size);
+            REQUIRE(read[i].payload_length == trace[i].payload_length);
+            REQUIRE(read[i].op == trace[i].op);
+        }
+
+        std::istringstream bad{ "# comment\n10 1 4 5 e\n10 1 4 5 x\n" };
+        REQUIRE_THROWS_AS(hc::read_trace(bad), std::runtime_error);
+
+        // Sizes a replay would have to allocate are bounded.
+        for( auto const *line : { "10 1 4097 5 e\n", "10 1 4 1073741825 e\n", "10 1 4 -5 e\n" } )
+        {
+            std::istringstream huge{ line };
+            REQUIRE_THROWS_AS(hc::read_trace(huge), std::runtime_error);
+        }
+
+        std::istringstream largest{ "10 1 4096 1073741824 d\n" };
+        REQUIRE(hc::read_trace(largest).size() == 1);
+    }
+
+    SECTION("Replay")
+    {
+        std::vector<std::string> outputs;
+
+        auto engine = [&](std::uint64_t, hc::hill_key const &key, hc::filter_mode op, std::string const &payload)
+        {
+            outputs.push_back(op == hc::filter_mode::encrypt ? hc::encrypt(key, payload) : hc::decrypt(key, payload));
+        };
+
+        auto report = hc::replay(trace, engine);
+
+        REQUIRE(report.operations == 3);
+        REQUIRE(report.payload_bytes == 105);
+        REQUIRE(outputs[0].length() == 100);
+        REQUIRE(outputs[1].length() == 9);
+        REQUIRE(outputs[2].empty());
+        REQUIRE(report.p50 <= report.p99);
+        REQUIRE(report.p99 <= report.max);
+
+        hc::replay_options options;
+        options.recorded_speed = true;
+        options.speedup = 1000.0;
+
+        std::vector<hc::trace_record> paced(5, trace[0]);
+        for( auto &r : paced )
+        {
+            r.gap = std::chrono::milliseconds{ 2000 };
+        }
+
+        // 5 gaps of 2 s at 1000x speed take at least 10 ms.
+        report = hc::replay(paced, engine, options);
+        REQUIRE(report.elapsed >= std::chrono::milliseconds{ 10 });
+
+        for( auto speedup : { 0.0, -1.0 } )
+        {
+            options.speedup = speedup;
+            REQUIRE_THROWS_AS(hc::replay(paced, engine, options), std::invalid_argument);
+        }
+    }
+}